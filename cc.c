@@ -0,0 +1,339 @@
+#include <limits.h>
+#include <math.h>
+#include <string.h>
+#include "cc.h"
+
+/* ******************************************************************
+   Congestion control, counted in packets: TCP Reno (RFC 5681), CUBIC
+   (RFC 8312) and a simplified BBR.
+**********************************************************************/
+
+#define INITIAL_CWND 1.0
+#define MIN_SSTHRESH 2.0
+#define RTT_GAIN 0.125     /* gain of the smoothed round trip time */
+
+/* Reno */
+
+static void reno_ack(struct cc *c, double now, int npackets, double rtt)
+{
+  while (npackets-- > 0) {
+    if (c->cwnd < c->ssthresh)
+      c->cwnd += 1.0;
+    else
+      c->cwnd += 1.0 / c->cwnd;
+  }
+}
+
+static void reno_halve(struct cc *c)
+{
+  c->ssthresh = c->cwnd / 2;
+  if (c->ssthresh < MIN_SSTHRESH)
+    c->ssthresh = MIN_SSTHRESH;
+}
+
+static int reno_loss(struct cc *c, double now)
+{
+  reno_halve(c);
+  c->cwnd = c->ssthresh;
+  return 1;
+}
+
+static int reno_timeout(struct cc *c, double now)
+{
+  reno_halve(c);
+  c->cwnd = INITIAL_CWND;
+  return 1;
+}
+
+/* CUBIC.  The simulation clock has no unit, so time on the curve is
+   counted in smoothed round trips rather than in seconds */
+
+#define CUBIC_C 0.4
+#define CUBIC_BETA 0.7
+
+static void cubic_init(struct cc *c)
+{
+  c->wmax = 0.0;
+  c->epoch = -1.0;
+}
+
+static void cubic_ack(struct cc *c, double now, int npackets, double rtt)
+{
+  double t, target;
+
+  if (c->cwnd < c->ssthresh) {
+    c->cwnd += npackets;
+    return;
+  }
+
+  /* a new curve starts with the first ACK after a cut */
+  if (c->epoch < 0.0) {
+    c->epoch = now;
+    if (c->cwnd < c->wmax) {
+      c->k = pow((c->wmax - c->cwnd) / CUBIC_C, 1.0 / 3.0);
+      c->origin = c->wmax;
+    }
+    else {
+      c->k = 0.0;
+      c->origin = c->cwnd;
+    }
+    c->west = c->cwnd;
+  }
+
+  /* aim for where the curve will be a round trip from now */
+  t = (now - c->epoch) / ((c->srtt > 0.0) ? c->srtt : 1.0) + 1.0;
+  target = c->origin + CUBIC_C * (t - c->k) * (t - c->k) * (t - c->k);
+  if (target > c->cwnd)
+    c->cwnd += npackets * (target - c->cwnd) / c->cwnd;
+  else
+    c->cwnd += npackets * 0.01 / c->cwnd;
+
+  /* never slower than Reno would be */
+  c->west += npackets * 3.0 * (1.0 - CUBIC_BETA) / (1.0 + CUBIC_BETA) / c->cwnd;
+  if (c->west > c->cwnd)
+    c->cwnd = c->west;
+}
+
+static void cubic_cut(struct cc *c)
+{
+  /* fast convergence: give up more of the window if it shrank since
+     the last cut, so that newer flows can catch up */
+  if (c->cwnd < c->wmax)
+    c->wmax = c->cwnd * (1.0 + CUBIC_BETA) / 2.0;
+  else
+    c->wmax = c->cwnd;
+  c->ssthresh = c->cwnd * CUBIC_BETA;
+  if (c->ssthresh < MIN_SSTHRESH)
+    c->ssthresh = MIN_SSTHRESH;
+  c->epoch = -1.0;
+}
+
+static int cubic_loss(struct cc *c, double now)
+{
+  cubic_cut(c);
+  c->cwnd = c->ssthresh;
+  return 1;
+}
+
+static int cubic_timeout(struct cc *c, double now)
+{
+  cubic_cut(c);
+  c->cwnd = INITIAL_CWND;
+  return 1;
+}
+
+/* BBR, simplified: a round lasts the smallest round trip time seen, and
+   the delivery rate of a round is the packets ACKed in it over its
+   length.  The bottleneck rate is the largest of the last BBR_ROUNDS.
+   Startup paces at a high gain until the rate stops growing, drain
+   spends one round below it, and probe_bw then cycles through the gains
+   below.  There is no probe_rtt phase and no app-limited marking */
+
+#define BBR_STARTUP 0
+#define BBR_DRAIN 1
+#define BBR_PROBE_BW 2
+
+#define BBR_HIGHGAIN 2.885 /* 2/ln 2, doubles the rate every round */
+#define BBR_CWNDGAIN 2.0
+#define BBR_MINCWND 4.0
+#define BBR_FULLBW 1.25    /* growth per round that keeps startup going */
+#define BBR_FULLBWROUNDS 3
+
+static const double bbr_cycle[] = { 1.25, 0.75, 1.0, 1.0, 1.0, 1.0, 1.0, 1.0 };
+#define BBR_CYCLE (sizeof(bbr_cycle) / sizeof(bbr_cycle[0]))
+
+static void bbr_init(struct cc *c)
+{
+  int i;
+
+  c->mode = BBR_STARTUP;
+  c->btlbw = 0.0;
+  for (i = 0; i < BBR_ROUNDS; i++)
+    c->bw[i] = 0.0;
+  c->round = 0;
+  c->roundstart = -1.0;
+  c->rounddelivered = 0;
+  c->fullbw = 0.0;
+  c->fullbwcount = 0;
+  c->cycle = 0;
+}
+
+/* a round ended with this delivery rate */
+static void bbr_round(struct cc *c, double rate)
+{
+  int i;
+
+  c->bw[c->round++ % BBR_ROUNDS] = rate;
+  c->btlbw = 0.0;
+  for (i = 0; i < BBR_ROUNDS; i++)
+    if (c->bw[i] > c->btlbw)
+      c->btlbw = c->bw[i];
+
+  switch (c->mode) {
+  case BBR_STARTUP:
+    if (c->btlbw >= c->fullbw * BBR_FULLBW) {
+      c->fullbw = c->btlbw;
+      c->fullbwcount = 0;
+    }
+    else if (++c->fullbwcount >= BBR_FULLBWROUNDS)
+      c->mode = BBR_DRAIN;
+    break;
+  case BBR_DRAIN:
+    c->mode = BBR_PROBE_BW;
+    c->cycle = 0;
+    break;
+  default:
+    c->cycle = (c->cycle + 1) % BBR_CYCLE;
+    break;
+  }
+}
+
+static void bbr_ack(struct cc *c, double now, int npackets, double rtt)
+{
+  if (c->roundstart < 0.0)
+    c->roundstart = now;
+  else {
+    c->rounddelivered += npackets;
+    if (c->minrtt > 0.0 && now - c->roundstart >= c->minrtt) {
+      bbr_round(c, c->rounddelivered / (now - c->roundstart));
+      c->roundstart = now;
+      c->rounddelivered = 0;
+    }
+  }
+
+  /* grow like slow start until there is a model, then towards a
+     multiple of the bandwidth-delay product */
+  if (c->btlbw == 0.0) {
+    c->cwnd += npackets;
+    return;
+  }
+  c->ssthresh = c->btlbw * c->minrtt * ((c->mode == BBR_STARTUP) ? BBR_HIGHGAIN : BBR_CWNDGAIN);
+  if (c->ssthresh < BBR_MINCWND)
+    c->ssthresh = BBR_MINCWND;
+  if (c->cwnd < c->ssthresh) {
+    c->cwnd += npackets;
+    if (c->cwnd > c->ssthresh)
+      c->cwnd = c->ssthresh;
+  }
+  else
+    c->cwnd = c->ssthresh;
+}
+
+static int bbr_loss(struct cc *c, double now)
+{
+  return 0;
+}
+
+/* the window rebuilds from the model with the next ACKs */
+static int bbr_timeout(struct cc *c, double now)
+{
+  c->cwnd = INITIAL_CWND;
+  return 1;
+}
+
+static double bbr_pacing_rate(const struct cc *c)
+{
+  switch (c->mode) {
+  case BBR_STARTUP:
+    return c->btlbw * BBR_HIGHGAIN;
+  case BBR_DRAIN:
+    return c->btlbw / BBR_HIGHGAIN;
+  default:
+    return c->btlbw * bbr_cycle[c->cycle];
+  }
+}
+
+static const struct ccops ccs[] = {
+  { "none", NULL, NULL, NULL, NULL, NULL },
+  { "reno", NULL, reno_ack, reno_loss, reno_timeout, NULL },
+  { "cubic", cubic_init, cubic_ack, cubic_loss, cubic_timeout, NULL },
+  { "bbr", bbr_init, bbr_ack, bbr_loss, bbr_timeout, bbr_pacing_rate },
+  { NULL, NULL, NULL, NULL, NULL, NULL }
+};
+
+int cc_find(const char *name)
+{
+  int i;
+
+  for (i = 0; ccs[i].name != NULL; i++)
+    if (strcmp(ccs[i].name, name) == 0)
+      return i;
+  return -1;
+}
+
+void cc_init(struct cc *c, int algorithm, int maxwindow)
+{
+  c->ops = &ccs[algorithm];
+  c->enabled = algorithm != 0;
+  c->cwnd = INITIAL_CWND;
+  c->maxwindow = maxwindow;
+  c->ssthresh = maxwindow;
+  c->lastcut = -1.0;
+  c->cuts = 0;
+  c->nextsend = 0.0;
+  c->srtt = 0.0;
+  c->minrtt = 0.0;
+  if (c->ops->init != NULL)
+    c->ops->init(c);
+}
+
+int cc_window(const struct cc *c)
+{
+  if (!c->enabled)
+    return INT_MAX;
+  return (int)c->cwnd;
+}
+
+double cc_pacing_rate(const struct cc *c)
+{
+  if (!c->enabled || c->ops->pacing_rate == NULL)
+    return 0.0;
+  return c->ops->pacing_rate(c);
+}
+
+int cc_cansend(const struct cc *c, int inflight, double now)
+{
+  return inflight < cc_window(c) && now >= c->nextsend;
+}
+
+void cc_sent(struct cc *c, double now)
+{
+  double rate = cc_pacing_rate(c);
+
+  if (rate > 0.0)
+    c->nextsend = now + 1.0 / rate;
+}
+
+void cc_ack(struct cc *c, double now, int npackets, double rtt)
+{
+  if (!c->enabled)
+    return;
+  if (rtt > 0.0) {
+    c->srtt = (c->srtt > 0.0) ? c->srtt + RTT_GAIN * (rtt - c->srtt) : rtt;
+    if (c->minrtt == 0.0 || rtt < c->minrtt)
+      c->minrtt = rtt;
+  }
+  c->ops->on_ack(c, now, npackets, rtt);
+  if (c->cwnd > c->maxwindow)
+    c->cwnd = c->maxwindow;
+}
+
+void cc_loss(struct cc *c, double now, double sent)
+{
+  if (!c->enabled || sent < c->lastcut)
+    return;
+  if (c->ops->on_loss(c, now)) {
+    c->lastcut = now;
+    c->cuts++;
+  }
+}
+
+void cc_timeout(struct cc *c, double now, double sent)
+{
+  if (!c->enabled || sent < c->lastcut)
+    return;
+  if (c->ops->on_timeout(c, now)) {
+    c->lastcut = now;
+    c->cuts++;
+  }
+}
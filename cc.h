@@ -0,0 +1,90 @@
+/* congestion control shared by the protocols.  The sender keeps no more
+   than cc_window() packets unACKed and, when the controller paces, sends
+   no faster than cc_pacing_rate().  The controllers (cc.c) are chosen by
+   name and see the sender only through the callbacks below:
+     reno   grows the window by a packet per ACK in slow start and by a
+            packet per window in congestion avoidance.  A loss halves it
+            and a timeout drops it to one packet.
+     cubic  grows it along the cubic curve of RFC 8312 around the window
+            of the last loss, and cuts it to 0.7 of its size.
+     bbr    ignores losses and sizes the window from its estimates of the
+            bottleneck rate and the round trip time, pacing at that rate.
+   A sender reacts once per window of data, so a loss reported for a
+   packet sent before the last cut is ignored. */
+struct cc;
+
+struct ccops {
+  const char *name;
+  void (*init)(struct cc *);
+
+  /* npackets were ACKed at time now, rtt is the round trip time they
+     measured or negative if they were resent */
+  void (*on_ack)(struct cc *, double now, int npackets, double rtt);
+
+  /* a loss was found by duplicate ACKs or by a timer, return 0 if the
+     controller does not react to it */
+  int (*on_loss)(struct cc *, double now);
+  int (*on_timeout)(struct cc *, double now);
+
+  /* packets per unit of time, 0 to send as fast as the window allows */
+  double (*pacing_rate)(const struct cc *);
+};
+
+#define BBR_ROUNDS 10     /* rounds the bottleneck rate estimate spans */
+
+struct cc {
+  const struct ccops *ops;
+  int enabled;            /* 0 to leave the window alone */
+  double cwnd;            /* congestion window, in packets */
+  double ssthresh;        /* slow start threshold, the target window for bbr */
+  double maxwindow;       /* the sender's window, cwnd never grows past it */
+  double lastcut;         /* time of the last cut */
+  int cuts;               /* number of cuts so far */
+  double nextsend;        /* earliest time of the next new packet when pacing */
+  double srtt;            /* smoothed round trip time, 0 before the first sample */
+  double minrtt;          /* smallest round trip time seen */
+
+  /* cubic */
+  double wmax;            /* window before the last cut */
+  double epoch;           /* start of the current growth curve, negative if none */
+  double k;               /* round trips until the curve reaches wmax again */
+  double origin;          /* window the curve levels off at */
+  double west;            /* window Reno would have */
+
+  /* bbr */
+  int mode;               /* startup, drain or probe_bw */
+  double btlbw;           /* bottleneck rate, packets per unit of time */
+  double bw[BBR_ROUNDS];  /* delivery rate of the last rounds */
+  int round;              /* rounds so far */
+  double roundstart;      /* start of the current round, negative before the first ACK */
+  int rounddelivered;     /* packets ACKed in the current round */
+  double fullbw;          /* rate startup last grew to */
+  int fullbwcount;        /* rounds startup has not grown it */
+  int cycle;              /* phase of the probe_bw gain cycle */
+};
+
+/* the index of the controller called name, 0 being none, or -1 if there
+   is no such controller */
+extern int cc_find(const char *name);
+
+extern void cc_init(struct cc *, int algorithm, int maxwindow);
+
+/* the most packets the sender may have unACKed */
+extern int cc_window(const struct cc *);
+
+/* packets per unit of time, 0 if the controller does not pace */
+extern double cc_pacing_rate(const struct cc *);
+
+/* returns true if the sender, with inflight packets unACKed, may send a
+   new packet at time now.  cc_sent() tells the pacing that it did */
+extern int cc_cansend(const struct cc *, int inflight, double now);
+extern void cc_sent(struct cc *, double now);
+
+/* npackets were ACKed for the first time, rtt is the round trip time
+   they measured or negative if they were resent */
+extern void cc_ack(struct cc *, double now, int npackets, double rtt);
+
+/* a packet last sent at time sent was found lost at time now, by
+   duplicate ACKs or by its timer */
+extern void cc_loss(struct cc *, double now, double sent);
+extern void cc_timeout(struct cc *, double now, double sent);
@@ -23,7 +23,8 @@
    - packets can be corrupted (either the header or the data portion)
    or lost, according to user-defined probabilities
    - packets will be delivered in the order in which they were sent
-   (although some can be lost).
+   (although some can be lost), unless reordering or duplication is
+   turned on with "-e" or "-u".
 
    Modifications (6/6/2008 - CLP): 
    - removed bidirectional GBN code and other code not used by prac. 
@@ -33,23 +34,86 @@
    soon as n packets are sent.
    - fixed C style to adhere to current programming style
 
+   Modifications:
+   - event list is a binary heap rather than a sorted linked list, so
+   scheduling an event is O(log n) in the number of pending events.
+   - a calendar queue scheduler can be selected instead with "-q calendar".
+   - the pending timer event of A and B is remembered, so starting and
+   stopping a timer no longer searches the event list.
+   - the latest arrival time in each direction of the channel is kept, so
+   tolayer3() no longer searches the event list to preserve ordering.
+   - events come from a slab pool and carry their packet inline, so the
+   main loop does no malloc/free per event.
+   - random numbers come from a seedable generator chosen with "-r" and
+   "-s", with a separate stream for each source of randomness.
+   - trace output is guarded by TRACING(level), and levels above TRACE_MAX
+   are compiled out.
+   - "-t file" records a compact binary trace of the run, which the
+   separate tracedump program prints as text.
+   - parameters can be given on the command line or in a config file
+   (run with -h for the list), and are only prompted for when missing.
+   - all emulator state lives in a struct sim passed to every routine, so
+   several simulations can run in one process.
+   - "-R n" runs n replications with consecutive seeds on a pool of
+   threads (runner.c) and reports the mean, standard deviation and 95%
+   confidence interval of each statistic.  Build with
+     gcc -pthread emulator.c runner.c rto.c cc.c replay.c gbn.c -lm
+   - "-S specfile" runs every cell of a parameter grid, spreading the cells
+   over worker threads with work stealing, and writes one CSV row of
+   statistics per cell to the CSV file given with "-o file".
+   - "-a adaptive" makes the protocols estimate their retransmission
+   timeout from the round trip times they measure (rto.c).
+   - "-D n" makes GBN resend its window after n duplicate ACKs.
+   - "-k 1" makes B report the packets it holds beyond the cumulative ACK
+   in the ACK payload, and A resend only the missing ones.
+   - the window size and sequence space of the protocols are only
+   limited by memory ("-w", "-N").
+   - "-C reno" limits the sender with a TCP Reno congestion window (cc.c),
+   "-W file" writes its time series.
+   - congestion controllers plug into cc.c's table; "-C cubic" and
+   "-C bbr" select CUBIC and a simplified, pacing BBR.
+   - "-b", "-p" and "-Q" replace the random channel delay with a link of
+   that rate, propagation delay and FIFO queue length, in each direction.
+   - "-A red" or "-A codel" manage the link queue, and the report gives
+   percentiles of the time packets wait in it.
+   - "-g", "-G", "-L" and "-K" make losses and corruption come in bursts
+   from a two state Gilbert-Elliott channel, the report counts the runs
+   of packets lost in a row by length, in either state.
+   - "-P file" replays the losses and delays of a recorded trace instead
+   of drawing them (replay.c).
+   - "-e" and "-E" let the channel hold packets back so that later ones
+   overtake them, "-u" makes it deliver packets twice.  "-O" bounds how
+   many packets may overtake one, and the protocols widen their sequence
+   space by as much.
+
    ********************************************************************* */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <stdint.h>
+#include <limits.h>
+#include <float.h>
+#include <math.h>
 #include "emulator.h"
+#include "trace.h"
+#include "runner.h"
 #include "gbn.h"
+#include "cc.h"
+#include "replay.h"
 
 struct event {
   float evtime;           /* event time */
   int evtype;             /* event type code */
   int eventity;           /* entity where event occurs */
-  struct pkt *pktptr;     /* ptr to packet (if any) assoc w/ this event */
-  struct event *prev;
+  struct pkt pkt;         /* copy of the packet (if any) assoc w/ this event */
+  unsigned long evseq;    /* insertion order, breaks ties between equal times */
+  int qpos;               /* heap index or calendar bucket holding this event */
+  struct event *prev;     /* neighbours within a calendar bucket */
   struct event *next;
 };
 
-struct event *evlist = NULL;   /* the event list */
-
 /* possible events: */
 #define  TIMER_INTERRUPT 0  
 #define  FROM_LAYER5     1
@@ -58,149 +122,1331 @@ struct event *evlist = NULL;   /* the event list */
 #define  OFF             0
 #define  ON              1
 
-int TRACE = 3;
+/* random number streams */
+#define  RNG_ARRIVAL     0   /* message interarrival times and senders */
+#define  RNG_LOSS        1   /* packet loss */
+#define  RNG_CORRUPT     2   /* packet corruption */
+#define  RNG_DELAY       3   /* channel delay */
+#define  RNG_AQM         4   /* random early detection */
+#define  RNG_BURST       5   /* Gilbert-Elliott state changes */
+#define  RNG_REORDER     6   /* reordering and duplication */
+#define  RNG_NSTREAMS    7
+
+#define  BURSTBINS       16  /* loss burst lengths counted apart, the last bin holds longer ones */
+
+/* the packets in one direction of the link model, being sent or waiting
+   to be, as a ring of the times they finish being sent */
+struct linkq {
+  float *done;
+  int first;                       /* slot of the oldest packet */
+  int count;                       /* packets in the link */
+  int capacity;                    /* allocated slots */
+  long offered;                    /* packets that reached the link */
+  double found;                    /* sum of the packets each of them found */
+  int peak;                        /* most packets in the link at once */
+  int drops;                       /* packets dropped by the full queue */
+  float idle;                      /* when the packets in the link will have been sent */
+  int aqmdrops;                    /* packets dropped by queue management */
+  float *sojourn;                  /* time each packet sent waited to be sent */
+  int nsojourn;
+  int sojourncap;                  /* allocated slots in sojourn */
+
+  /* RED */
+  double redavg;                   /* average queue length */
+  int redcount;                    /* packets accepted since the last drop */
+
+  /* CoDel */
+  float firstabove;                /* when the sojourn time may be called too long, 0 if it is short */
+  float dropnext;                  /* time of the next drop while dropping */
+  int dropping;
+  int codelcount;                  /* drops in this dropping state */
+  int lastcount;                   /* drops in the previous one */
+};
+
+/* a packet held back or duplicated, which arrives later than its
+   place in the channel */
+struct held {
+  float evtime;                    /* when it arrives */
+  long sent;                       /* its number among the packets of its direction */
+};
+
+/* the emulator's part of a simulation */
+struct emu {
+  /* event list */
+  const struct evqueue *evq;       /* scheduler in use */
+  unsigned long evseqnext;         /* sequence number for next insertion */
+  struct event *pendingtimer[2];   /* timer event of A and B, if running */
+
+  /* binary heap scheduler */
+  struct event **evheap;
+  int evcount;                     /* number of events in the heap */
+  int evcapacity;                  /* allocated slots in evheap */
+
+  /* calendar queue scheduler */
+  struct event **cqbuckets;
+  int cqnbuckets;                  /* number of days in a year */
+  double cqwidth;                  /* length of a day in time units */
+  int cqsize;                      /* number of events in the calendar */
+  long cqday;                      /* absolute day number of current day */
+  int cqresizable;                 /* resize disabled while resizing */
+  int cqresizes;                   /* number of times calendar was resized */
+
+  /* event pool */
+  struct evslab *evslabs;          /* all slabs allocated so far */
+  struct event *evfreelist;        /* events available for reuse */
+  int nevslabs;                    /* number of slabs allocated */
+  long nevallocs;                  /* number of events handed out */
+  int nevinuse;                    /* events currently handed out */
+  int nevpeak;                     /* most events ever in use at once */
+
+  /* random numbers */
+  const struct rng *rng;           /* generator in use */
+  uint64_t xoshiro_state[RNG_NSTREAMS][4];
+
+  /* binary trace */
+  FILE *tracefp;                   /* binary trace file, if any */
+  struct tracerec *tracebuf;       /* ring of TRACEBUF records */
+  int tracenext;                   /* next slot to fill in tracebuf */
+  int tracepending;                /* records filled but not written yet */
+  long tracerecs;                  /* number of records written */
 
-/* statistics updated by GBN */
-int window_full;   /* count of the number of messages dropped due to full window */
-int total_ACKs_received;
-int packets_resent;       /* count of the number of packets resent  */
-int new_ACKs;           /* count of the number of acks correctly received */
-int packets_received;  /* count of the packets received by receiver */
-
-/* statistics updated by emulator */
-static int packets_lost;  
-static int packets_corrupt;
-static int packets_sent;
-static int packets_timeout;
-static int messages_delivered;
-
-static int nsim = 0;              /* number of messages from 5 to 4 so far */ 
-static int nsimmax = 0;           /* number of msgs to generate, then stop */
-static float time = 0.000;
-static float lossprob;            /* probability that a packet is dropped  */
-static float corruptprob;   /* probability that one bit is packet is flipped */
-static int corruptdirection; /* A->B A<-B or bidirectional corruption/loss */
-static float lambda;        /* arrival rate of messages from layer 5 */   
-static int   ntolayer3;           /* number sent into layer 3 */
-static int   nlost;               /* number lost in media */
-static int ncorrupt;              /* number corrupted by media*/
+  /* congestion window time series */
+  FILE *cwndfp;
+
+  /* channel */
+  float lastarrival[2];            /* latest arrival time scheduled at A and B */
+  struct linkq linkq[2];           /* link model from A and from B */
+  int bad[2];                      /* Gilbert-Elliott state from A and from B */
+  int lossrun[2];                  /* packets lost in a row so far from A and from B */
+  int bursts[BURSTBINS];           /* loss bursts by length */
+  long nbursts;
+  long burstlost;                  /* packets lost in all of them */
+  struct replay *replay;           /* trace replayed, if any */
+
+  /* packets held back or duplicated from A and from B that packets sent
+     after them may still overtake, oldest first, in a ring of
+     2 * (reorderdepth + 1) */
+  struct held *held[2];
+  int heldfirst[2];
+  int heldcount[2];
+  long nsent[2];                   /* packets sent from A and from B */
+};
+
+int TRACE = 3;
 
 /****************************************************************************/
 /* jimsrand(): return a double in range [0,1].  The routine below is used to */
-/* isolate all random number generation in one location.  We assume that the*/
-/* system-supplied rand() function return an int in therange [0,mmm]        */
+/* isolate all random number generation in one location.  Each use of       */
+/* randomness draws from its own stream so that, for example, changing the  */
+/* loss probability does not shift the delays seen by later packets.         */
+/* The generator itself is chosen at startup:                                */
+/*   xoshiro - xoshiro256** (Blackman & Vigna), identical on every platform, */
+/*             each stream is the seeded state advanced by 2^128 draws       */
+/*   libc    - the system rand(), all streams share its single state.  With  */
+/*             seed 9999 this reproduces the results of earlier versions.    */
+/*             Its state is also shared by every simulation in the process,  */
+/*             so it is only suitable for running one simulation at a time  */
 /****************************************************************************/
-double jimsrand(void) 
+
+struct rng {
+  const char *name;
+  void (*seed)(struct emu *e, unsigned long seed);
+  double (*uniform)(struct emu *e, int stream);
+  int shared;    /* true if one state serves every simulation in the process */
+};
+
+static uint64_t rotl64(uint64_t x, int k)
+{
+  return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t splitmix64(uint64_t *x)
+{
+  uint64_t z = (*x += UINT64_C(0x9e3779b97f4a7c15));
+  z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+  z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+  return z ^ (z >> 31);
+}
+
+static uint64_t xoshiro_next(uint64_t *st)
+{
+  uint64_t result = rotl64(st[1] * 5, 7) * 9;
+  uint64_t t = st[1] << 17;
+
+  st[2] ^= st[0];
+  st[3] ^= st[1];
+  st[1] ^= st[2];
+  st[0] ^= st[3];
+  st[2] ^= t;
+  st[3] = rotl64(st[3], 45);
+  return result;
+}
+
+/* advance st by 2^128 draws */
+static void xoshiro_jump(uint64_t *st)
+{
+  static const uint64_t jump[4] = {
+    UINT64_C(0x180ec6d33cfd0aba), UINT64_C(0xd5a61266f0c9392c),
+    UINT64_C(0xa9582618e03fc9aa), UINT64_C(0x39abdc4529b1661c)
+  };
+  uint64_t t[4] = { 0, 0, 0, 0 };
+  int i, b, k;
+
+  for (i = 0; i < 4; i++)
+    for (b = 0; b < 64; b++) {
+      if (jump[i] & (UINT64_C(1) << b))
+        for (k = 0; k < 4; k++)
+          t[k] ^= st[k];
+      xoshiro_next(st);
+    }
+  for (k = 0; k < 4; k++)
+    st[k] = t[k];
+}
+
+static void xoshiro_seed(struct emu *e, unsigned long seed)
+{
+  uint64_t x = seed;
+  int i, k;
+
+  for (k = 0; k < 4; k++)
+    e->xoshiro_state[0][k] = splitmix64(&x);
+  for (i = 1; i < RNG_NSTREAMS; i++) {
+    for (k = 0; k < 4; k++)
+      e->xoshiro_state[i][k] = e->xoshiro_state[i-1][k];
+    xoshiro_jump(e->xoshiro_state[i]);
+  }
+}
+
+static double xoshiro_uniform(struct emu *e, int stream)
+{
+  /* top 53 bits give a double uniform on [0,1) */
+  return (xoshiro_next(e->xoshiro_state[stream]) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void libc_seed(struct emu *e, unsigned long seed)
+{
+  srand((unsigned int)seed);
+}
+
+static double libc_uniform(struct emu *e, int stream)
 {
   double mmm = RAND_MAX;     /* largest int  - MACHINE DEPENDENT!!!!!!!!   */
+  return rand()/mmm;         /* x should be uniform in [0,1] */
+}
+
+static const struct rng rngs[] = {
+  { "xoshiro", xoshiro_seed, xoshiro_uniform, 0 },
+  { "libc", libc_seed, libc_uniform, 1 },
+  { NULL, NULL, NULL, 0 }
+};
+
+double jimsrand(struct sim *s, int stream) 
+{
   double x;                   
-  x = rand()/mmm;            /* x should be uniform in [0,1] */
-  if (TRACE > 3)
+  x = s->emu->rng->uniform(s->emu, stream);  /* x should be uniform in [0,1] */
+  if (TRACING(4))
     printf("RANDOM NUMBER GENERAION CALLED: %f\n", x);
   return(x);
 }  
 
+/************************** BINARY TRACE ************/
+/*  With "-t file" every event and channel action is */
+/*  recorded as a fixed size struct tracerec.        */
+/*  Records collect in an in-memory ring, which is   */
+/*  written out a block at a time.                   */
+/*****************************************************/
+
+#define TRACEBUF   65536  /* records in the ring */
+#define TRACEBLOCK 16384  /* records written at once, divides TRACEBUF */
+
+/* write the records not written yet, oldest first.  Blocks start at
+   multiples of TRACEBLOCK, so they never wrap around the end of the ring */
+static void traceflush(struct emu *e)
+{
+  int first = e->tracenext - e->tracepending;
+
+  if (first < 0)
+    first += TRACEBUF;
+  if (e->tracepending > 0
+      && fwrite(&e->tracebuf[first], sizeof(struct tracerec), e->tracepending, e->tracefp) != (size_t)e->tracepending) {
+    printf("writing binary trace failed.\n");
+    exit(EXIT_FAILURE);
+  }
+  e->tracepending = 0;
+}
+
+static void traceopen(struct emu *e, const char *path)
+{
+  struct traceheader hdr;
+
+  e->tracefp = fopen(path, "wb");
+  e->tracebuf = malloc(TRACEBUF * sizeof(struct tracerec));
+  if (e->tracefp == NULL || e->tracebuf == NULL) {
+    printf("unable to open binary trace file %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+  memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+  hdr.version = TRACE_VERSION;
+  hdr.recsize = sizeof(struct tracerec);
+  fwrite(&hdr, sizeof(hdr), 1, e->tracefp);
+}
+
+static void traceclose(struct emu *e)
+{
+  traceflush(e);
+  fclose(e->tracefp);
+  free(e->tracebuf);
+  e->tracefp = NULL;
+}
+
+static void tracerecord(struct sim *s, int kind, int entity, int seqnum, int acknum, int flags)
+{
+  struct emu *e = s->emu;
+  struct tracerec *r;
+
+  if (e->tracefp == NULL)
+    return;
+  r = &e->tracebuf[e->tracenext];
+  r->time = s->time;
+  r->kind = kind;
+  r->entity = entity;
+  r->flags = flags;
+  r->seqnum = seqnum;
+  r->acknum = acknum;
+  e->tracerecs++;
+  e->tracenext = (e->tracenext + 1) % TRACEBUF;
+  if (++e->tracepending == TRACEBLOCK)
+    traceflush(e);
+}
+
+/************************** EVENT POOL **************/
+/*  Events are carved out of slabs and recycled on a */
+/*  free list rather than malloc'ed one at a time     */
+/*****************************************************/
+
+#define EVSLAB 256        /* events allocated per slab */
+
+struct evslab {
+  struct evslab *next;
+  struct event events[EVSLAB];
+};
+
+static struct event *newevent(struct emu *e)
+{
+  struct evslab *slab;
+  struct event *p;
+  int i;
+
+  if (e->evfreelist == NULL) {   /* free list is empty, carve a new slab */
+    slab = malloc(sizeof(struct evslab));
+    if (slab == 0) {
+      printf("memory allocation for event failed.");
+      exit(EXIT_FAILURE);
+    }
+    slab->next = e->evslabs;
+    e->evslabs = slab;
+    e->nevslabs++;
+    for (i = EVSLAB - 1; i >= 0; i--) {
+      slab->events[i].next = e->evfreelist;
+      e->evfreelist = &slab->events[i];
+    }
+  }
+  p = e->evfreelist;
+  e->evfreelist = p->next;
+  e->nevallocs++;
+  if (++e->nevinuse > e->nevpeak)
+    e->nevpeak = e->nevinuse;
+  return p;
+}
+
+static void freeevent(struct emu *e, struct event *p)
+{
+  p->next = e->evfreelist;
+  e->evfreelist = p;
+  e->nevinuse--;
+}
+
 /********************* EVENT HANDLINE ROUTINES *******/
 /*  The next set of routines handle the event list   */
 /*****************************************************/
 
-void insertevent(struct event *p)
+/* an event scheduler.  iter(NULL) returns the first pending event and
+   iter(p) the one after p, in no particular order */
+struct evqueue {
+  const char *name;
+  void (*insert)(struct sim *s, struct event *p);
+  struct event *(*pop)(struct sim *s);
+  void (*remove)(struct sim *s, struct event *p);
+  struct event *(*iter)(struct sim *s, struct event *p);
+};
+
+/* returns true if event a must be simulated before event b.  Among events
+   with equal times the most recently inserted one goes first, which is the
+   order the original sorted-list insertion produced */
+static int evbefore(struct event *a, struct event *b)
 {
-  struct event *q,*qold;
+  if (a->evtime != b->evtime)
+    return (a->evtime < b->evtime);
+  return (a->evseq > b->evseq);
+}
 
-  if (TRACE>2) {
-    printf("            INSERTEVENT: time is %f\n",time);
-    printf("            INSERTEVENT: future time will be %f\n",p->evtime); 
+/* ---- binary heap scheduler ---- */
+
+static void evplace(struct emu *e, struct event *p, int pos)
+{
+  e->evheap[pos] = p;
+  p->qpos = pos;
+}
+
+static void evsiftup(struct emu *e, int pos)
+{
+  struct event *p = e->evheap[pos];
+  int parent;
+
+  while (pos > 0) {
+    parent = (pos - 1) / 2;
+    if (!evbefore(p, e->evheap[parent]))
+      break;
+    evplace(e, e->evheap[parent], pos);
+    pos = parent;
   }
-  q = evlist;     /* q points to front of list in which p struct inserted */
-  if (q==NULL) {   /* list is empty */
-    evlist=p;
-    p->next=NULL;
-    p->prev=NULL;
+  evplace(e, p, pos);
+}
+
+static void evsiftdown(struct emu *e, int pos)
+{
+  struct event *p = e->evheap[pos];
+  int child;
+
+  while ((child = 2*pos + 1) < e->evcount) {
+    if (child + 1 < e->evcount && evbefore(e->evheap[child+1], e->evheap[child]))
+      child++;
+    if (!evbefore(e->evheap[child], p))
+      break;
+    evplace(e, e->evheap[child], pos);
+    pos = child;
   }
-  else {
-    for (qold = q; q !=NULL && p->evtime > q->evtime; q=q->next)
-      qold=q; 
-    if (q==NULL) {   /* end of list */
-      qold->next = p;
-      p->prev = qold;
-      p->next = NULL;
+  evplace(e, p, pos);
+}
+
+static void heap_insert(struct sim *s, struct event *p)
+{
+  struct emu *e = s->emu;
+  struct event **newheap;
+
+  if (e->evcount == e->evcapacity) {   /* heap is full, double its size */
+    e->evcapacity = e->evcapacity ? 2*e->evcapacity : 64;
+    newheap = realloc(e->evheap, e->evcapacity * sizeof(struct event *));
+    if (newheap == 0) {
+      printf("memory allocation for event list failed.");
+      exit(EXIT_FAILURE);
     }
-    else if (q==evlist) { /* front of list */
-      p->next=evlist;
-      p->prev=NULL;
-      p->next->prev=p;
-      evlist = p;
+    e->evheap = newheap;
+  }
+  evplace(e, p, e->evcount++);
+  evsiftup(e, p->qpos);
+}
+
+static struct event *heap_pop(struct sim *s)
+{
+  struct emu *e = s->emu;
+  struct event *p;
+
+  if (e->evcount == 0)
+    return NULL;
+  p = e->evheap[0];
+  if (--e->evcount > 0) {
+    evplace(e, e->evheap[e->evcount], 0);
+    evsiftdown(e, 0);
+  }
+  return p;
+}
+
+static void heap_remove(struct sim *s, struct event *p)
+{
+  struct emu *e = s->emu;
+  int pos = p->qpos;
+
+  if (--e->evcount > pos) {
+    evplace(e, e->evheap[e->evcount], pos);
+    if (pos > 0 && evbefore(e->evheap[pos], e->evheap[(pos-1)/2]))
+      evsiftup(e, pos);
+    else
+      evsiftdown(e, pos);
+  }
+}
+
+static struct event *heap_iter(struct sim *s, struct event *p)
+{
+  int pos = (p == NULL) ? 0 : p->qpos + 1;
+  return (pos < s->emu->evcount) ? s->emu->evheap[pos] : NULL;
+}
+
+/* ---- calendar queue scheduler (R. Brown, CACM 31(10), 1988) ----
+   Events are hashed by time into nbuckets "days" of width cqwidth, each
+   day holding a sorted list.  Dequeue walks the days of the current
+   "year" in order.  The number of days tracks the number of pending
+   events and the day width is re-estimated from the event spacing each
+   time the calendar is resized. */
+
+#define CQ_MINBUCKETS 2
+#define CQ_SAMPLES    25   /* events sampled to estimate a new day width */
+
+static long cq_dayof(struct emu *e, double t)
+{
+  return (long)(t / e->cqwidth);
+}
+
+static void cq_link(struct emu *e, struct event *p)
+{
+  struct event *q, *qold;
+  int i = (int)(cq_dayof(e, p->evtime) % e->cqnbuckets);
+
+  p->qpos = i;
+  qold = NULL;
+  for (q = e->cqbuckets[i]; q != NULL && evbefore(q, p); q = q->next)
+    qold = q;
+  p->prev = qold;
+  p->next = q;
+  if (q != NULL)
+    q->prev = p;
+  if (qold != NULL)
+    qold->next = p;
+  else
+    e->cqbuckets[i] = p;
+}
+
+static void cq_unlink(struct emu *e, struct event *p)
+{
+  if (p->prev != NULL)
+    p->prev->next = p->next;
+  else
+    e->cqbuckets[p->qpos] = p->next;
+  if (p->next != NULL)
+    p->next->prev = p->prev;
+}
+
+static void cq_setup(struct sim *s, int nbuckets, double width)
+{
+  struct emu *e = s->emu;
+  int i;
+
+  e->cqbuckets = malloc(nbuckets * sizeof(struct event *));
+  if (e->cqbuckets == 0) {
+    printf("memory allocation for event list failed.");
+    exit(EXIT_FAILURE);
+  }
+  for (i = 0; i < nbuckets; i++)
+    e->cqbuckets[i] = NULL;
+  e->cqnbuckets = nbuckets;
+  e->cqwidth = width;
+  e->cqday = cq_dayof(e, s->time);
+}
+
+static struct event *cq_pop(struct sim *s);
+static void cq_insert(struct sim *s, struct event *p);
+
+/* estimate a day width of about three times the average spacing of the
+   next few events, ignoring gaps far larger than the average */
+static double cq_newwidth(struct sim *s)
+{
+  struct emu *e = s->emu;
+  struct event *sample[CQ_SAMPLES];
+  double gap, sum, avg;
+  int n, i, used;
+
+  if (e->cqsize < 2)
+    return e->cqwidth;
+  n = e->cqsize < CQ_SAMPLES ? e->cqsize : CQ_SAMPLES;
+  for (i = 0; i < n; i++)
+    sample[i] = cq_pop(s);
+  sum = 0.0;
+  for (i = 1; i < n; i++)
+    sum += sample[i]->evtime - sample[i-1]->evtime;
+  avg = sum / (n - 1);
+  sum = 0.0;
+  used = 0;
+  for (i = 1; i < n; i++) {
+    gap = sample[i]->evtime - sample[i-1]->evtime;
+    if (gap <= 2.0 * avg) {
+      sum += gap;
+      used++;
     }
-    else {     /* middle of list */
-      p->next=q;
-      p->prev=q->prev;
-      q->prev->next=p;
-      q->prev=p;
+  }
+  for (i = n - 1; i >= 0; i--)
+    cq_insert(s, sample[i]);
+  if (used == 0 || sum <= 0.0)
+    return e->cqwidth;
+  return 3.0 * sum / used;
+}
+
+static void cq_resize(struct sim *s, int nbuckets)
+{
+  struct emu *e = s->emu;
+  struct event **oldbuckets = e->cqbuckets;
+  int oldnbuckets = e->cqnbuckets;
+  struct event *p, *pnext;
+  double width;
+  int i;
+
+  e->cqresizable = 0;
+  width = cq_newwidth(s);
+  cq_setup(s, nbuckets, width);
+  for (i = 0; i < oldnbuckets; i++)
+    for (p = oldbuckets[i]; p != NULL; p = pnext) {
+      pnext = p->next;
+      cq_link(e, p);
     }
+  free(oldbuckets);
+  e->cqresizes++;
+  e->cqresizable = 1;
+}
+
+static void cq_insert(struct sim *s, struct event *p)
+{
+  struct emu *e = s->emu;
+
+  if (e->cqbuckets == NULL)
+    cq_setup(s, CQ_MINBUCKETS, 1.0);
+  cq_link(e, p);
+  e->cqsize++;
+  if (e->cqresizable && e->cqsize > 2 * e->cqnbuckets)
+    cq_resize(s, 2 * e->cqnbuckets);
+}
+
+static void cq_shrink(struct sim *s)
+{
+  struct emu *e = s->emu;
+
+  if (e->cqresizable && e->cqnbuckets > CQ_MINBUCKETS && e->cqsize < e->cqnbuckets / 2 - 2)
+    cq_resize(s, e->cqnbuckets / 2);
+}
+
+static struct event *cq_pop(struct sim *s)
+{
+  struct emu *e = s->emu;
+  struct event *p = NULL, *best;
+  int i, n;
+
+  if (e->cqsize == 0)
+    return NULL;
+  /* look through one year of days starting at the current one */
+  for (n = 0; n < e->cqnbuckets; n++, e->cqday++) {
+    p = e->cqbuckets[e->cqday % e->cqnbuckets];
+    if (p != NULL && cq_dayof(e, p->evtime) <= e->cqday)
+      break;
   }
+  if (n == e->cqnbuckets) {
+    /* nothing due within a year: jump straight to the earliest event */
+    best = NULL;
+    for (i = 0; i < e->cqnbuckets; i++)
+      if (e->cqbuckets[i] != NULL && (best == NULL || evbefore(e->cqbuckets[i], best)))
+        best = e->cqbuckets[i];
+    p = best;
+    e->cqday = cq_dayof(e, p->evtime);
+  }
+  cq_unlink(e, p);
+  e->cqsize--;
+  cq_shrink(s);
+  return p;
 }
 
-void generate_next_arrival(void)
+static void cq_remove(struct sim *s, struct event *p)
+{
+  cq_unlink(s->emu, p);
+  s->emu->cqsize--;
+  cq_shrink(s);
+}
+
+static struct event *cq_iter(struct sim *s, struct event *p)
+{
+  struct emu *e = s->emu;
+  int i;
+
+  if (p != NULL && p->next != NULL)
+    return p->next;
+  for (i = (p == NULL) ? 0 : p->qpos + 1; i < e->cqnbuckets; i++)
+    if (e->cqbuckets[i] != NULL)
+      return e->cqbuckets[i];
+  return NULL;
+}
+
+static const struct evqueue evqueues[] = {
+  { "heap", heap_insert, heap_pop, heap_remove, heap_iter },
+  { "calendar", cq_insert, cq_pop, cq_remove, cq_iter },
+  { NULL, NULL, NULL, NULL, NULL }
+};
+
+void insertevent(struct sim *s, struct event *p)
+{
+  if (TRACING(3)) {
+    printf("            INSERTEVENT: time is %f\n",s->time);
+    printf("            INSERTEVENT: future time will be %f\n",p->evtime); 
+  }
+  p->evseq = s->emu->evseqnext++;
+  s->emu->evq->insert(s, p);
+}
+
+/* remove and return the next event to simulate, NULL if there is none */
+struct event *popevent(struct sim *s)
+{
+  return s->emu->evq->pop(s);
+}
+
+/* take an arbitrary event out of the event list */
+static void removeevent(struct sim *s, struct event *p)
+{
+  s->emu->evq->remove(s, p);
+}
+
+void generate_next_arrival(struct sim *s)
 {
   double x;
   struct event *evptr;
 
-  if (TRACE>2)
+  if (TRACING(3))
     printf("          GENERATE NEXT ARRIVAL: creating new arrival\n");
  
-  x = lambda*jimsrand()*2;  /* x is uniform on [0,2*lambda] */
+  x = s->cfg->lambda*jimsrand(s, RNG_ARRIVAL)*2;  /* x is uniform on [0,2*lambda] */
   /* having mean of lambda        */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
-  evptr->evtime =  time + x;
+  evptr = newevent(s->emu);
+  evptr->evtime =  s->time + x;
   evptr->evtype =  FROM_LAYER5;
-  if (BIDIRECTIONAL && (jimsrand()>0.5) )
+  if (BIDIRECTIONAL && (jimsrand(s, RNG_ARRIVAL)>0.5) )
     evptr->eventity = B;
   else
     evptr->eventity = A;
-  insertevent(evptr);
+  insertevent(s, evptr);
 } 
 
-void printevlist(void)
+void printevlist(struct sim *s)
 {
+  const struct evqueue *evq = s->emu->evq;
   struct event *q;
-  printf("--------------\nEvent List Follows:\n");
-  for(q = evlist; q!=NULL; q=q->next) {
+  printf("--------------\nEvent List Follows (%s order):\n", evq->name);
+  for (q = evq->iter(s, NULL); q!=NULL; q = evq->iter(s, q)) {
     printf("Event time: %f, type: %d entity: %d\n",q->evtime,q->evtype,q->eventity);
   }
   printf("--------------\n");
 }
 
-void init(void)                         /* initialize the simulator */
+/************************** QUEUE MANAGEMENT *******/
+/*  The link queue drops packets before it is full  */
+/*  to keep the time they wait short.  A policy may */
+/*  drop a packet as it arrives or as it reaches    */
+/*  the head of the queue, at the time given, after */
+/*  waiting there for sojourn time units.           */
+/****************************************************/
+
+struct aqm {
+  const char *name;
+  int (*arrive)(struct sim *s, int AorB);
+  int (*depart)(struct sim *s, int AorB, float now, float sojourn);
+};
+
+/* RED (Floyd and Jacobson 1993), in packets */
+#define RED_MINTH 5.0
+#define RED_MAXTH 15.0
+#define RED_MAXP  0.1
+#define RED_WQ    0.002
+
+static int red_arrive(struct sim *s, int AorB)
+{
+  const struct link *lk = &s->cfg->link[AorB];
+  struct linkq *q = &s->emu->linkq[AorB];
+  double pb, pa;
+
+  /* while the link is idle the average decays as if packets finding it
+     empty had kept arriving */
+  if (q->count == 0)
+    q->redavg *= pow(1.0 - RED_WQ, (s->time - q->idle) * lk->bandwidth / sizeof(struct pkt));
+  else
+    q->redavg += RED_WQ * (q->count - q->redavg);
+
+  if (q->redavg < RED_MINTH) {
+    q->redcount = -1;
+    return 0;
+  }
+  if (q->redavg >= RED_MAXTH) {
+    q->redcount = 0;
+    return 1;
+  }
+
+  /* spread the drops out evenly between packets */
+  q->redcount++;
+  pb = RED_MAXP * (q->redavg - RED_MINTH) / (RED_MAXTH - RED_MINTH);
+  pa = (q->redcount * pb < 1.0) ? pb / (1.0 - q->redcount * pb) : 1.0;
+  if (jimsrand(s, RNG_AQM) < pa) {
+    q->redcount = 0;
+    return 1;
+  }
+  return 0;
+}
+
+/* CoDel (RFC 8289).  The round trip of the original channel is about 11
+   time units, so an interval of 10 plays the part of CoDel's 100 ms */
+#define CODEL_TARGET   0.5
+#define CODEL_INTERVAL 10.0
+
+static float codel_controllaw(float t, int count)
+{
+  return t + CODEL_INTERVAL / sqrt(count);
+}
+
+static int codel_depart(struct sim *s, int AorB, float now, float sojourn)
+{
+  struct linkq *q = &s->emu->linkq[AorB];
+  int toolong, delta;
+
+  /* the sojourn time is too long once it stayed above target for an
+     interval */
+  if (sojourn < CODEL_TARGET) {
+    q->firstabove = 0.0;
+    toolong = 0;
+  }
+  else if (q->firstabove == 0.0) {
+    q->firstabove = now + CODEL_INTERVAL;
+    toolong = 0;
+  }
+  else
+    toolong = now >= q->firstabove;
+
+  if (q->dropping) {
+    if (!toolong) {
+      q->dropping = 0;
+      return 0;
+    }
+    if (now < q->dropnext)
+      return 0;
+    q->codelcount++;
+    q->dropnext = codel_controllaw(q->dropnext, q->codelcount);
+    return 1;
+  }
+  if (!toolong)
+    return 0;
+
+  /* start dropping, at the rate the last dropping state ended with if
+     that was recent */
+  q->dropping = 1;
+  delta = q->codelcount - q->lastcount;
+  q->codelcount = (delta > 1 && now - q->dropnext < 16 * CODEL_INTERVAL) ? delta : 1;
+  q->lastcount = q->codelcount;
+  q->dropnext = codel_controllaw(now, q->codelcount);
+  return 1;
+}
+
+static const struct aqm aqms[] = {
+  { "droptail", NULL, NULL },
+  { "red", red_arrive, NULL },
+  { "codel", NULL, codel_depart },
+  { NULL, NULL, NULL }
+};
+
+/************************** PARAMETERS **************/
+/*  Parameters can be given on the command line or   */
+/*  as "key = value" lines in a config file read     */
+/*  with -f.  Whatever the original prompts ask for   */
+/*  and was not given this way is still prompted for. */
+/*****************************************************/
+
+/* the parameters of the simulation run by main() */
+static struct simconfig config = {
+  0, 0.0, 0.0, 0, 0.0,  /* prompted for if not given */
+  9999,                 /* seed */
+  0, 0,                 /* heap scheduler, xoshiro generator */
+  NULL,                 /* no binary trace */
+  0, 0, 0.0,            /* protocol's own window size, sequence space and timeout */
+  0,                    /* fixed timeout */
+  0,                    /* no fast retransmit */
+  0,                    /* no selective acknowledgements */
+  0, NULL,              /* no congestion control */
+  { { 0.0, 0.0, 0, 0 }, { 0.0, 0.0, 0, 0 } },  /* original channel */
+  0.0, 0.25, 1.0, 0.0,  /* independent losses, a bad state loses everything for 4 packets on average */
+  NULL,                 /* no replay */
+  0.0, 10.0, 0.0, 8     /* no reordering or duplication */
+};
+
+static int replications = 0;   /* independent runs to summarise, 0 for one plain run */
+static int threads = 0;        /* worker threads for replications, 0 for one per processor */
+static const char *sweepfile = NULL;  /* sweep specification, NULL for no sweep */
+static const char *csvfile = NULL;    /* sweep results, needed with a sweep */
+
+#define P_INT    0
+#define P_FLOAT  1
+#define P_DOUBLE 2
+#define P_ULONG  3
+#define P_NAME   4   /* value is handed to setname() */
+
+struct param {
+  const char *key;     /* name in a config file */
+  const char *flag;    /* command line flag */
+  const char *help;
+  int type;
+  void *var;           /* variable set by a numeric parameter, NULL if it is in struct simconfig */
+  size_t offset;       /* otherwise the offset of the field set */
+  double min, max;     /* range allowed for numeric parameters */
+  int (*setname)(struct simconfig *cfg, const char *value);
+  int given;           /* set once a value has been given */
+};
+
+#define VAR(v)     &(v), 0
+#define CFG(field) NULL, offsetof(struct simconfig, field)
+
+/* choose the event scheduler by name, returns 0 if there is no such one */
+static int selectevqueue(struct simconfig *cfg, const char *name)
+{
+  int i;
+
+  for (i = 0; evqueues[i].name != NULL; i++)
+    if (strcmp(evqueues[i].name, name) == 0) {
+      cfg->scheduler = i;
+      return 1;
+    }
+  return 0;
+}
+
+/* choose the random number generator by name, returns 0 if there is none */
+static int selectrng(struct simconfig *cfg, const char *name)
 {
-  float sum, avg;
   int i;
 
+  for (i = 0; rngs[i].name != NULL; i++)
+    if (strcmp(rngs[i].name, name) == 0) {
+      cfg->rng = i;
+      return 1;
+    }
+  return 0;
+}
+
+char *emu_savestring(const char *str)
+{
+  char *copy = malloc(strlen(str) + 1);
+
+  if (copy != NULL)
+    strcpy(copy, str);
+  return copy;
+}
+
+static int settracefile(struct simconfig *cfg, const char *path)
+{
+  free((char *)cfg->tracefile);
+  return (cfg->tracefile = emu_savestring(path)) != NULL;
+}
+
+static int selectrto(struct simconfig *cfg, const char *name)
+{
+  if (strcmp(name, "fixed") == 0)
+    cfg->rtomode = 0;
+  else if (strcmp(name, "adaptive") == 0)
+    cfg->rtomode = 1;
+  else
+    return 0;
+  return 1;
+}
+
+static int selectcongestion(struct simconfig *cfg, const char *name)
+{
+  int i = cc_find(name);
+
+  if (i < 0)
+    return 0;
+  cfg->congestion = i;
+  return 1;
+}
+
+/* a link parameter is "x" for both directions or "x/y" for the link
+   from A and the one from B */
+static int linkvalues(const char *value, double *fromA, double *fromB)
+{
+  char *end;
+
+  *fromA = strtod(value, &end);
+  if (end == value)
+    return 0;
+  *fromB = *fromA;
+  if (*end == '/') {
+    value = end + 1;
+    *fromB = strtod(value, &end);
+    if (end == value)
+      return 0;
+  }
+  return *end == '\0' && *fromA >= 0.0 && *fromB >= 0.0;
+}
+
+static int setbandwidth(struct simconfig *cfg, const char *value)
+{
+  double fromA, fromB;
+
+  if (!linkvalues(value, &fromA, &fromB))
+    return 0;
+  cfg->link[A].bandwidth = fromA;
+  cfg->link[B].bandwidth = fromB;
+  return 1;
+}
+
+static int setdelay(struct simconfig *cfg, const char *value)
+{
+  double fromA, fromB;
+
+  if (!linkvalues(value, &fromA, &fromB))
+    return 0;
+  cfg->link[A].delay = fromA;
+  cfg->link[B].delay = fromB;
+  return 1;
+}
+
+static int setqueue(struct simconfig *cfg, const char *value)
+{
+  double fromA, fromB;
+
+  if (!linkvalues(value, &fromA, &fromB) || fromA != (int)fromA || fromB != (int)fromB
+      || fromA > INT_MAX || fromB > INT_MAX)
+    return 0;
+  cfg->link[A].queue = (int)fromA;
+  cfg->link[B].queue = (int)fromB;
+  return 1;
+}
+
+/* the index of the queue management policy whose name is the first len
+   characters of name, -1 if there is none */
+static int findaqm(const char *name, size_t len)
+{
+  int i;
+
+  for (i = 0; aqms[i].name != NULL; i++)
+    if (strlen(aqms[i].name) == len && strncmp(aqms[i].name, name, len) == 0)
+      return i;
+  return -1;
+}
+
+static int setaqm(struct simconfig *cfg, const char *value)
+{
+  const char *slash = strchr(value, '/');
+  int fromA, fromB;
+
+  fromA = findaqm(value, (slash != NULL) ? (size_t)(slash - value) : strlen(value));
+  fromB = (slash != NULL) ? findaqm(slash + 1, strlen(slash + 1)) : fromA;
+  if (fromA < 0 || fromB < 0)
+    return 0;
+  cfg->link[A].aqm = fromA;
+  cfg->link[B].aqm = fromB;
+  return 1;
+}
+
+static int setreplayfile(struct simconfig *cfg, const char *path)
+{
+  return (cfg->replayfile = emu_savestring(path)) != NULL;
+}
+
+static int setcwndfile(struct simconfig *cfg, const char *path)
+{
+  return (cfg->cwndfile = emu_savestring(path)) != NULL;
+}
+
+static int setsweepfile(struct simconfig *cfg, const char *path)
+{
+  return (sweepfile = emu_savestring(path)) != NULL;
+}
+
+static int setcsvfile(struct simconfig *cfg, const char *path)
+{
+  return (csvfile = emu_savestring(path)) != NULL;
+}
+
+static struct param params[] = {
+  { "messages", "-n", "number of messages to simulate", P_INT, CFG(nsimmax), 0, INT_MAX, NULL, 0 },
+  { "loss", "-l", "packet loss probability", P_FLOAT, CFG(lossprob), 0, 1, NULL, 0 },
+  { "corrupt", "-c", "packet corruption probability", P_FLOAT, CFG(corruptprob), 0, 1, NULL, 0 },
+  { "replay", "-P", "replay the losses and delays of this trace file (see replay.h)", P_NAME, CFG(replayfile), 0, 0, setreplayfile, 0 },
+  { "reorder", "-e", "probability that the channel holds a packet back and lets later ones overtake it (default 0)", P_FLOAT, CFG(reorderprob), 0, 1, NULL, 0 },
+  { "reorderdelay", "-E", "mean time a held back packet is delayed by (default 10)", P_DOUBLE, CFG(reorderdelay), 0, 1e30, NULL, 0 },
+  { "reorderdepth", "-O", "most packets sent after a held back or duplicated one that may arrive before it (default 8)", P_INT, CFG(reorderdepth), 0, 1024, NULL, 0 },
+  { "duplicate", "-u", "probability that the channel delivers a packet twice (default 0)", P_FLOAT, CFG(dupprob), 0, 1, NULL, 0 },
+  { "direction", "-d", "loss/corruption/reordering/duplication direction: 0 A->B, 1 A<-B, 2 both", P_INT, CFG(corruptdirection), 0, 2, NULL, 0 },
+  { "goodbad", "-g", "probability per packet of the channel turning bad (default 0, independent losses)", P_DOUBLE, CFG(goodbad), 0, 1, NULL, 0 },
+  { "badgood", "-G", "probability per packet of the channel turning good again, above 0 (default 0.25)", P_DOUBLE, CFG(badgood), FLT_MIN, 1, NULL, 0 },
+  { "badloss", "-L", "packet loss probability while the channel is bad (default 1)", P_FLOAT, CFG(badloss), 0, 1, NULL, 0 },
+  { "badcorrupt", "-K", "packet corruption probability while the channel is bad (default 0)", P_FLOAT, CFG(badcorrupt), 0, 1, NULL, 0 },
+  { "lambda", "-m", "average time between messages from layer 5", P_FLOAT, CFG(lambda), FLT_MIN, 1e30, NULL, 0 },
+  { "trace", "-v", "TRACE level", P_INT, VAR(TRACE), 0, INT_MAX, NULL, 0 },
+  { "seed", "-s", "random number seed (default 9999)", P_ULONG, CFG(seed), 0, 0, NULL, 0 },
+  { "window", "-w", "sender window size (default: protocol's own)", P_INT, CFG(windowsize), 1, INT_MAX, NULL, 0 },
+  { "seqspace", "-N", "number of sequence numbers (default: the least the protocol allows, 2*window for GBN with -k 1)", P_INT, CFG(seqspace), 2, INT_MAX, NULL, 0 },
+  { "rtt", "-T", "retransmission timeout, the initial one if adaptive, at least 1 (default: protocol's own)", P_DOUBLE, CFG(rtt), 1, 1e30, NULL, 0 },
+  { "rto", "-a", "retransmission timeout: fixed or adaptive (default fixed)", P_NAME, CFG(rtomode), 0, 0, selectrto, 0 },
+  { "dupacks", "-D", "duplicate ACKs that trigger a fast retransmit (default 0, never)", P_INT, CFG(dupacks), 0, INT_MAX, NULL, 0 },
+  { "sack", "-k", "1 to send a selective acknowledgement bitmap in every ACK (default 0)", P_INT, CFG(sack), 0, 1, NULL, 0 },
+  { "congestion", "-C", "congestion control: none, reno, cubic or bbr (default none)", P_NAME, CFG(congestion), 0, 0, selectcongestion, 0 },
+  { "cwndfile", "-W", "write the congestion window time series to this CSV file", P_NAME, CFG(cwndfile), 0, 0, setcwndfile, 0 },
+  { "bandwidth", "-b", "link rate in bytes per time unit, \"x\" or \"A->B/B->A\" (default 0, the original channel)", P_NAME, CFG(link), 0, 0, setbandwidth, 0 },
+  { "delay", "-p", "propagation delay of the link, \"x\" or \"A->B/B->A\" (default 0)", P_NAME, CFG(link), 0, 0, setdelay, 0 },
+  { "queue", "-Q", "packets the link queues behind the one being sent, \"x\" or \"A->B/B->A\" (default 0, no limit)", P_NAME, CFG(link), 0, 0, setqueue, 0 },
+  { "aqm", "-A", "link queue management: droptail, red or codel, \"x\" or \"A->B/B->A\" (default droptail)", P_NAME, CFG(link), 0, 0, setaqm, 0 },
+  { "scheduler", "-q", "event scheduler: heap or calendar (default heap)", P_NAME, CFG(scheduler), 0, 0, selectevqueue, 0 },
+  { "rng", "-r", "random number generator: xoshiro or libc (default xoshiro)", P_NAME, CFG(rng), 0, 0, selectrng, 0 },
+  { "tracefile", "-t", "write a binary event trace to this file (see tracedump)", P_NAME, CFG(tracefile), 0, 0, settracefile, 0 },
+  { "replications", "-R", "run this many replications with seeds seed, seed+1, ... and summarise them", P_INT, VAR(replications), 1, INT_MAX, NULL, 0 },
+  { "threads", "-j", "worker threads for replications and sweeps (default one per processor)", P_INT, VAR(threads), 1, INT_MAX, NULL, 0 },
+  { "sweep", "-S", "run every combination of the values in this sweep specification", P_NAME, VAR(sweepfile), 0, 0, setsweepfile, 0 },
+  { "csv", "-o", "write the sweep results to this CSV file, needed with -S", P_NAME, VAR(csvfile), 0, 0, setcsvfile, 0 },
+  { NULL, NULL, NULL, 0, NULL, 0, 0, 0, NULL, 0 }
+};
+
+/* look a parameter up by config file key or by command line flag */
+static struct param *findparam(const char *name)
+{
+  struct param *p;
+
+  for (p = params; p->key != NULL; p++)
+    if (strcmp(p->key, name) == 0 || strcmp(p->flag, name) == 0)
+      return p;
+  return NULL;
+}
+
+/* returns true if the parameter with this key was given */
+static int paramgiven(const char *key)
+{
+  return findparam(key)->given;
+}
+
+/* set a parameter of cfg from its text value, returns 0 if the value is
+   invalid.  Parameters that are not part of a simconfig are set directly.
+   The caller marks the parameter as given, a sweep cell does not */
+static int setparam(struct param *p, struct simconfig *cfg, const char *value)
+{
+  void *var = (p->var != NULL) ? p->var : (char *)cfg + p->offset;
+  char *end;
+  double d = 0.0;
+  long l = 0;
+  unsigned long ul = 0;
+
+  if (p->type == P_NAME) {
+    return p->setname(cfg, value);
+  }
+  if (p->type == P_INT)
+    d = l = strtol(value, &end, 10);
+  else if (p->type == P_ULONG) {
+    /* strtoul() takes a minus sign and wraps the number around */
+    if (strchr(value, '-') != NULL)
+      return 0;
+    errno = 0;
+    ul = strtoul(value, &end, 10);
+    if (errno == ERANGE)
+      return 0;
+  }
+  else
+    d = strtod(value, &end);
+  if (end == value || *end != '\0')
+    return 0;
+  if (p->type != P_ULONG && (d < p->min || d > p->max))
+    return 0;
+  if (p->type == P_INT)
+    *(int *)var = (int)l;
+  else if (p->type == P_FLOAT)
+    *(float *)var = (float)d;
+  else if (p->type == P_DOUBLE)
+    *(double *)var = d;
+  else
+    *(unsigned long *)var = ul;
+  return 1;
+}
+
+int simconfig_set(struct simconfig *cfg, const char *key, const char *value)
+{
+  struct param *p = findparam(key);
+
+  if (p == NULL || strcmp(p->flag, key) == 0 || p->var != NULL)
+    return 0;
+  return setparam(p, cfg, value);
+}
+
+void simconfig_release(struct simconfig *cfg, const struct simconfig *from)
+{
+  if (cfg->tracefile != from->tracefile)
+    free((char *)cfg->tracefile);
+  if (cfg->cwndfile != from->cwndfile)
+    free((char *)cfg->cwndfile);
+  if (cfg->replayfile != from->replayfile)
+    free((char *)cfg->replayfile);
+}
+
+char *emu_trim(char *str)
+{
+  char *end;
+
+  while (*str == ' ' || *str == '\t')
+    str++;
+  end = str + strlen(str);
+  while (end > str && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n' || end[-1] == '\r'))
+    end--;
+  *end = '\0';
+  return str;
+}
+
+/* read "key = value" lines from a config file, '#' starts a comment */
+static void readconfig(const char *path)
+{
+  char line[256];
+  char *key, *value, *cp;
+  struct param *p;
+  int lineno = 0;
+  FILE *fp;
+
+  fp = fopen(path, "r");
+  if (fp == NULL) {
+    printf("unable to open config file %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    lineno++;
+    if ((cp = strchr(line, '#')) != NULL)
+      *cp = '\0';
+    key = emu_trim(line);
+    if (*key == '\0')
+      continue;
+    if ((cp = strchr(key, '=')) == NULL) {
+      printf("%s:%d: expected key = value\n", path, lineno);
+      exit(EXIT_FAILURE);
+    }
+    *cp = '\0';
+    key = emu_trim(key);
+    value = emu_trim(cp + 1);
+    if ((p = findparam(key)) == NULL || strcmp(p->flag, key) == 0) {
+      printf("%s:%d: unknown parameter %s\n", path, lineno, key);
+      exit(EXIT_FAILURE);
+    }
+    if (!setparam(p, &config, value)) {
+      printf("%s:%d: invalid %s: %s\n", path, lineno, key, value);
+      exit(EXIT_FAILURE);
+    }
+    p->given = 1;
+  }
+  fclose(fp);
+}
+
+static void usage(const char *prog)
+{
+  struct param *p;
+
+  printf("usage: %s [-f configfile] [flag value]...\n", prog);
+  printf("  -f  read \"key = value\" parameters from configfile\n");
+  for (p = params; p->key != NULL; p++)
+    printf("  %s  %s (key %s)\n", p->flag, p->help, p->key);
+  printf("parameters that are not given are prompted for\n");
+  exit(EXIT_FAILURE);
+}
+
+/* read command line parameters, later ones override earlier ones */
+static void parseargs(int argc, char *argv[])
+{
+  struct param *p;
+  int i;
+
+  for (i=1; i<argc; i++) {
+    if (i+1 == argc)
+      usage(argv[0]);
+    if (strcmp(argv[i], "-f") == 0)
+      readconfig(argv[++i]);
+    else if ((p = findparam(argv[i])) != NULL && strcmp(p->flag, argv[i]) == 0) {
+      if (!setparam(p, &config, argv[++i])) {
+        printf("invalid %s: %s\n", p->key, argv[i]);
+        usage(argv[0]);
+      }
+      p->given = 1;
+    }
+    else
+      usage(argv[0]);
+  }
+}
+
+void init(void)                         /* ask for the parameters not given */
+{
   printf("-----  Stop and Wait Network Simulator Version 1.1 -------- \n\n");
-  printf("Enter the number of messages to simulate: ");
-  scanf("%d",&nsimmax);
-  printf("Enter  packet loss probability [enter 0.0 for no loss]:");
-  scanf("%f",&lossprob);
-  printf("Enter packet corruption probability [0.0 for no corruption]:");
-  scanf("%f",&corruptprob);
-  if (lossprob != 0.0 || corruptprob != 0.0) {
+  if (!paramgiven("messages")) {
+    printf("Enter the number of messages to simulate: ");
+    scanf("%d",&config.nsimmax);
+  }
+  if (!paramgiven("loss")) {
+    printf("Enter  packet loss probability [enter 0.0 for no loss]:");
+    scanf("%f",&config.lossprob);
+  }
+  if (!paramgiven("corrupt")) {
+    printf("Enter packet corruption probability [0.0 for no corruption]:");
+    scanf("%f",&config.corruptprob);
+  }
+  if ((config.lossprob != 0.0 || config.corruptprob != 0.0 || config.goodbad != 0.0
+       || config.reorderprob != 0.0 || config.dupprob != 0.0 || sweepfile != NULL)
+      && !paramgiven("direction")) {
     printf("If you want loss or corruption to only occur in one direction, choose the direction: 0 A->B, 1 A<-B, 2 A<->B (both directions) :");
-    scanf("%d",&corruptdirection);
+    scanf("%d",&config.corruptdirection);
+  }
+  if (!paramgiven("lambda")) {
+    printf("Enter average time between messages from sender's layer5 [ > 0.0]:");
+    scanf("%f",&config.lambda);
   }
-  printf("Enter average time between messages from sender's layer5 [ > 0.0]:");
-  scanf("%f",&lambda);
-  printf("Enter TRACE:");
-  scanf("%d",&TRACE);
+  if (!paramgiven("trace")) {
+    printf("Enter TRACE:");
+    scanf("%d",&TRACE);
+  }
+  if (TRACE > TRACE_MAX)
+    printf("Warning: this build only traces up to level %d\n", TRACE_MAX);
+}
 
+/********************** SIMULATIONS ***********************/
 
-  srand(9999);              /* init random number generator */
+int sim_threadsafe(const struct simconfig *cfg)
+{
+  return !rngs[cfg->rng].shared;
+}
+
+int sim_reorderdepth(const struct simconfig *cfg)
+{
+  if (cfg->reorderprob <= 0.0 && cfg->dupprob <= 0.0)
+    return 0;
+  return cfg->reorderdepth;
+}
+
+struct sim *sim_create(const struct simconfig *cfg)
+{
+  struct sim *s;
+  struct emu *e;
+  float sum, avg;
+  int i;
+
+  s = calloc(1, sizeof(struct sim));
+  e = calloc(1, sizeof(struct emu));
+  if (s == NULL || e == NULL) {
+    printf("memory allocation for simulation failed.");
+    exit(EXIT_FAILURE);
+  }
+  s->cfg = cfg;
+  s->emu = e;
+  e->evq = &evqueues[cfg->scheduler];
+  e->rng = &rngs[cfg->rng];
+  e->cqwidth = 1.0;
+  e->cqresizable = 1;
+  if (cfg->tracefile != NULL)
+    traceopen(e, cfg->tracefile);
+  if (cfg->cwndfile != NULL) {
+    if ((e->cwndfp = fopen(cfg->cwndfile, "w")) == NULL) {
+      printf("unable to open congestion window file %s\n", cfg->cwndfile);
+      exit(EXIT_FAILURE);
+    }
+    fprintf(e->cwndfp, "time,entity,cwnd,ssthresh\n");
+  }
+  if (cfg->replayfile != NULL)
+    e->replay = replay_open(cfg->replayfile);
+  if (cfg->reorderprob > 0.0 || cfg->dupprob > 0.0)
+    for (i = 0; i < 2; i++)
+      if ((e->held[i] = malloc(2 * (cfg->reorderdepth + 1) * sizeof(struct held))) == NULL) {
+        printf("memory allocation for simulation failed.");
+        exit(EXIT_FAILURE);
+      }
+
+  e->rng->seed(e, cfg->seed);  /* init random number generator */
   sum = 0.0;                /* test random number generator for students */
   for (i=0; i<1000; i++)
-    sum+=jimsrand();    /* jimsrand() should be uniform in [0,1] */
+    sum+=jimsrand(s, RNG_ARRIVAL);    /* jimsrand() should be uniform in [0,1] */
   avg = sum/1000.0;
   if (avg < 0.25 || avg > 0.75) {
     printf("It is likely that random number generation on your machine\n" ); 
@@ -209,174 +1455,460 @@ void init(void)                         /* initialize the simulator */
     exit(EXIT_FAILURE);
   }
 
-  /* initialise statistics */
-  window_full = 0;
-  total_ACKs_received = 0;
-  packets_resent = 0;
-  new_ACKs = 0;
-  packets_received = 0;
-  packets_lost = 0;  
-  packets_corrupt = 0;
-  packets_sent = 0;
-  packets_timeout = 0;
-  messages_delivered = 0;
+  s->time=0.0;                    /* initialize time to 0.0 */
+  generate_next_arrival(s);       /* initialize event list */
+  A_init(s);
+  B_init(s);
+  return s;
+}
 
-  ntolayer3 = 0;
-  nlost = 0;
-  ncorrupt = 0;
+void sim_destroy(struct sim *s)
+{
+  struct emu *e = s->emu;
+  struct evslab *slab;
 
-  time=0.0;                    /* initialize time to 0.0 */
-  generate_next_arrival();     /* initialize event list */
+  if (e->tracefp != NULL)
+    traceclose(e);
+  if (e->cwndfp != NULL)
+    fclose(e->cwndfp);
+  if (e->replay != NULL)
+    replay_close(e->replay);
+  while ((slab = e->evslabs) != NULL) {
+    e->evslabs = slab->next;
+    free(slab);
+  }
+  free(e->evheap);
+  free(e->cqbuckets);
+  free(e->linkq[A].done);
+  free(e->linkq[B].done);
+  free(e->linkq[A].sojourn);
+  free(e->linkq[B].sojourn);
+  free(e->held[A]);
+  free(e->held[B]);
+  free(e);
+  free(s->A_state);
+  free(s->B_state);
+  free(s);
 }
 
 /********************** Student-callable ROUTINES ***********************/
 
 /* called by students routine to cancel a previously-started timer */
-void stoptimer(int AorB)
+void stoptimer(struct sim *s, int AorB)
 /* A or B is trying to stop timer */
 {
+  struct emu *e = s->emu;
   struct event *q;
 
-  if (TRACE>1)
-    printf("          STOP TIMER: stopping timer at %f\n",time);
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next) 
-    if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
-      /* remove this event */
-      if (q->next==NULL && q->prev==NULL)
-        evlist=NULL;         /* remove first and only event on list */
-      else if (q->next==NULL) /* end of list - there is one in front */
-        q->prev->next = NULL;
-      else if (q==evlist) { /* front of list - there must be event after */
-        q->next->prev=NULL;
-        evlist = q->next;
-      }
-      else {     /* middle of list */
-        q->next->prev = q->prev;
-        q->prev->next =  q->next;
-      }
-      free(q);
-      return;
-    }
+  if (TRACING(2))
+    printf("          STOP TIMER: stopping timer at %f\n",s->time);
+  tracerecord(s, TR_STOPTIMER, AorB, 0, 0, 0);
+  q = e->pendingtimer[AorB];
+  if (q != NULL) {
+    /* remove this event */
+    removeevent(s, q);
+    freeevent(e, q);
+    e->pendingtimer[AorB] = NULL;
+    return;
+  }
   printf("Warning: unable to cancel your timer. It wasn't running.\n");
 }
 
 
-void starttimer(int AorB, double increment)
+void recordcwnd(struct sim *s, int AorB, double cwnd, double ssthresh)
+{
+  struct emu *e = s->emu;
+
+  if (e->cwndfp != NULL)
+    fprintf(e->cwndfp, "%f,%c,%g,%g\n", s->time, (AorB == A) ? 'A' : 'B', cwnd, ssthresh);
+}
+
+void starttimer(struct sim *s, int AorB, double increment)
 /* A or B is trying to start timer */
 {
 
-  struct event *q;
+  struct emu *e = s->emu;
   struct event *evptr;
 
-  if (TRACE>1)
-    printf("          START TIMER: starting timer at %f\n",time);
+  if (TRACING(2))
+    printf("          START TIMER: starting timer at %f\n",s->time);
+  tracerecord(s, TR_STARTTIMER, AorB, 0, 0, 0);
   /* be nice: check to see if timer is already started, if so, then  warn */
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next)  */
-  for (q=evlist; q!=NULL ; q = q->next)  
-    if ( (q->evtype==TIMER_INTERRUPT  && q->eventity==AorB) ) { 
-      printf("Warning: attempt to start a timer that is already started\n");
-      return;
-    }
+  if (e->pendingtimer[AorB] != NULL) {
+    printf("Warning: attempt to start a timer that is already started\n");
+    return;
+  }
  
   /* create future event for when timer goes off */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
-  evptr->evtime =  time + increment;
+  evptr = newevent(e);
+  evptr->evtime =  s->time + increment;
   evptr->evtype =  TIMER_INTERRUPT;
    
  
   evptr->eventity = AorB;
-  insertevent(evptr);
+  insertevent(s, evptr);
+  e->pendingtimer[AorB] = evptr;
 } 
 
 
 /************************** TOLAYER3 ***************/
-void tolayer3(int AorB, struct pkt packet)
+/* note a packet the link from AorB drops, flag tells why */
+static void linkdrop(struct sim *s, int AorB, struct pkt *packet, int flag)
+{
+  if (TRACING(1)) {
+    if (flag == TRF_QUEUE)
+      printf("          TOLAYER3: packet dropped by the full link queue\n");
+    else
+      printf("          TOLAYER3: packet dropped by queue management\n");
+  }
+  tracerecord(s, TR_LOST, AorB, packet->seqnum, packet->acknum, flag);
+}
+
+/* put a packet on the link model from AorB.  Returns the time it arrives
+   at the other side, delay after it was sent, or a negative time if the
+   link drops it */
+static float linksend(struct sim *s, int AorB, struct pkt *packet, double delay)
+{
+  const struct link *lk = &s->cfg->link[AorB];
+  const struct aqm *aqm = &aqms[lk->aqm];
+  struct emu *e = s->emu;
+  struct linkq *q = &e->linkq[AorB];
+  float *newdone, *newsojourn;
+  float start;
+  int i, j;
+
+  /* forget the packets that have been sent */
+  while (q->count > 0 && q->done[q->first] <= s->time) {
+    q->first = (q->first + 1) % q->capacity;
+    q->count--;
+  }
+
+  q->offered++;
+  q->found += q->count;
+  s->queuemean = (e->linkq[A].found + e->linkq[B].found) / (e->linkq[A].offered + e->linkq[B].offered);
+  if (lk->queue > 0 && q->count > lk->queue) {
+    q->drops++;
+    s->nqueuedrop++;
+    linkdrop(s, AorB, packet, TRF_QUEUE);
+    return -1.0;
+  }
+  if (aqm->arrive != NULL && aqm->arrive(s, AorB)) {
+    q->aqmdrops++;
+    s->naqmdrop++;
+    linkdrop(s, AorB, packet, TRF_AQM);
+    return -1.0;
+  }
+
+  if (q->count == q->capacity) {   /* ring is full, double its size */
+    i = q->capacity ? 2*q->capacity : 16;
+    newdone = malloc(i * sizeof(float));
+    if (newdone == NULL) {
+      printf("memory allocation for link queue failed.");
+      exit(EXIT_FAILURE);
+    }
+    for (j = 0; j < q->count; j++)
+      newdone[j] = q->done[(q->first + j) % q->capacity];
+    free(q->done);
+    q->done = newdone;
+    q->first = 0;
+    q->capacity = i;
+  }
+
+  /* sent after the packets ahead of it.  One that queue management drops
+     as it reaches the head of the queue takes no time to send, but
+     waits there like the others */
+  start = (q->count > 0) ? q->idle : s->time;
+  i = (q->first + q->count) % q->capacity;
+  q->count++;
+  if (q->count > q->peak)
+    q->peak = q->count;
+  if (aqm->depart != NULL && aqm->depart(s, AorB, start, start - s->time)) {
+    q->done[i] = q->idle = start;
+    q->aqmdrops++;
+    s->naqmdrop++;
+    linkdrop(s, AorB, packet, TRF_AQM);
+    return -1.0;
+  }
+  q->done[i] = q->idle = start + sizeof(struct pkt) / lk->bandwidth;
+
+  if (q->nsojourn == q->sojourncap) {
+    q->sojourncap = q->sojourncap ? 2*q->sojourncap : 64;
+    newsojourn = realloc(q->sojourn, q->sojourncap * sizeof(float));
+    if (newsojourn == NULL) {
+      printf("memory allocation for link queue failed.");
+      exit(EXIT_FAILURE);
+    }
+    q->sojourn = newsojourn;
+  }
+  q->sojourn[q->nsojourn++] = start - s->time;
+  return q->done[i] + delay;
+}
+
+/* a link that sent nothing */
+static const struct linkq nolink;
+
+static int floatcmp(const void *a, const void *b)
+{
+  float x = *(const float *)a, y = *(const float *)b;
+
+  return (x > y) - (x < y);
+}
+
+/* the p quantile of the sojourn times of two links, which are sorted */
+static float sojournquantile(const struct linkq *a, const struct linkq *b, double p)
+{
+  int n = a->nsojourn + b->nsojourn;
+  int i = 0, j = 0, k;
+
+  if (n == 0)
+    return 0.0;
+  k = (int)ceil(p * n) - 1;
+  if (k < 0)
+    k = 0;
+  for (;;) {
+    if (j == b->nsojourn || (i < a->nsojourn && a->sojourn[i] <= b->sojourn[j])) {
+      if (i + j == k)
+        return a->sojourn[i];
+      i++;
+    }
+    else {
+      if (i + j == k)
+        return b->sojourn[j];
+      j++;
+    }
+  }
+}
+
+/* the simulation ended, sort the sojourn times and publish their
+   quantiles over both links */
+static void linkfinish(struct sim *s)
+{
+  struct emu *e = s->emu;
+  int i;
+
+  for (i = A; i <= B; i++)
+    if (e->linkq[i].nsojourn > 0)
+      qsort(e->linkq[i].sojourn, e->linkq[i].nsojourn, sizeof(float), floatcmp);
+  s->sojourn50 = sojournquantile(&e->linkq[A], &e->linkq[B], 0.5);
+  s->sojourn99 = sojournquantile(&e->linkq[A], &e->linkq[B], 0.99);
+}
+
+/* returns true if the channel from AorB loses, corrupts and reorders
+   packets, as "direction" selects */
+static int impaired(const struct simconfig *cfg, int AorB)
+{
+  return !(AorB == B && cfg->corruptdirection == A) && !(AorB == A && cfg->corruptdirection == B);
+}
+
+/* move the Gilbert-Elliott channel from AorB on by a packet, returns
+   true if it is bad */
+static int channelstate(struct sim *s, int AorB)
+{
+  struct emu *e = s->emu;
+
+  if (jimsrand(s, RNG_BURST) < (e->bad[AorB] ? s->cfg->badgood : s->cfg->goodbad))
+    e->bad[AorB] = !e->bad[AorB];
+  return e->bad[AorB];
+}
+
+/* a packet from AorB got through the channel, ending the run of packets
+   lost before it if there is one.  Runs count every loss, in the good
+   state as well as the bad, as that is what the receiver sees */
+static void lossburst(struct sim *s, int AorB)
+{
+  struct emu *e = s->emu;
+  int n = e->lossrun[AorB];
+
+  if (n == 0)
+    return;
+  e->bursts[(n < BURSTBINS) ? n - 1 : BURSTBINS - 1]++;
+  e->nbursts++;
+  e->burstlost += n;
+  e->lossrun[AorB] = 0;
+  s->lossburst = (double)e->burstlost / e->nbursts;
+}
+
+/* count a packet sent from AorB.  The packets held back or duplicated
+   reorderdepth or more packets before it may no longer be overtaken, so
+   it and every later one arrive after them */
+static void heldsend(struct sim *s, int AorB)
+{
+  struct emu *e = s->emu;
+  struct held *h;
+  int to = (AorB + 1) % 2;
+
+  e->nsent[AorB]++;
+  while (e->heldcount[AorB] > 0) {
+    h = &e->held[AorB][e->heldfirst[AorB]];
+    if (e->nsent[AorB] - h->sent <= s->cfg->reorderdepth)
+      break;
+    if (e->lastarrival[to] < h->evtime)
+      e->lastarrival[to] = h->evtime;
+    e->heldfirst[AorB] = (e->heldfirst[AorB] + 1) % (2 * (s->cfg->reorderdepth + 1));
+    e->heldcount[AorB]--;
+  }
+}
+
+/* remember a packet from AorB that arrives at evtime, later than its
+   place in the channel.  Each of the last reorderdepth + 1 packets adds
+   at most a held back packet and a copy, so the ring never overflows */
+static void heldadd(struct sim *s, int AorB, float evtime)
+{
+  struct emu *e = s->emu;
+  int n = 2 * (s->cfg->reorderdepth + 1);
+  struct held *h = &e->held[AorB][(e->heldfirst[AorB] + e->heldcount[AorB]) % n];
+
+  h->evtime = evtime;
+  h->sent = e->nsent[AorB];
+  e->heldcount[AorB]++;
+}
+
+void tolayer3(struct sim *s, int AorB, struct pkt packet)
 /* A or B is sending to network  */
 {
+  const struct simconfig *cfg = s->cfg;
+  struct emu *e = s->emu;
   struct pkt *mypktptr;
-  struct event *evptr,*q;
-  float lastime, x;
-  int i;
+  struct event *evptr;
+  float lastime, x, arrival = 0.0;
+  float lossprob = cfg->lossprob, corruptprob = cfg->corruptprob;
+  double delay = cfg->link[AorB].delay;
+  struct event *dupptr;
+  int i, reordered, replayed = REPLAY_NONE;
+
+  s->ntolayer3++;
+  if (e->held[AorB] != NULL)
+    heldsend(s, AorB);
 
-  ntolayer3++;
+  /* a replayed trace decides about loss and delay, unless it has nothing
+     for this direction */
+  if (e->replay != NULL)
+    replayed = replay_next(e->replay, AorB, &delay);
 
   /* simulate losses: */
-  if (jimsrand() < lossprob && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
-    nlost++;
-    if (TRACE>0)    
+  if (replayed == REPLAY_NONE && cfg->goodbad > 0.0 && channelstate(s, AorB)) {
+    lossprob = cfg->badloss;
+    corruptprob = cfg->badcorrupt;
+  }
+  if (replayed == REPLAY_LOST
+      || (replayed == REPLAY_NONE && jimsrand(s, RNG_LOSS) < lossprob && impaired(cfg, AorB))) {
+    s->nlost++;
+    if (TRACING(1))    
       printf("          TOLAYER3: packet being lost\n");
+    tracerecord(s, TR_LOST, AorB, packet.seqnum, packet.acknum, 0);
+    e->lossrun[AorB]++;
     return;
   }  
+  lossburst(s, AorB);
+
+  if (cfg->link[AorB].bandwidth > 0.0 && (arrival = linksend(s, AorB, &packet, delay)) < 0.0)
+    return;
+
+  /* create future event for arrival of packet at the other side */
+  evptr = newevent(e);
 
   /* make a copy of the packet student just gave me since he/she may decide */
   /* to do something with the packet after we return back to him/her */ 
-  mypktptr = malloc(sizeof(struct pkt));
-  if (mypktptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
+  mypktptr = &evptr->pkt;
   mypktptr->seqnum = packet.seqnum;
   mypktptr->acknum = packet.acknum;
   mypktptr->checksum = packet.checksum;
   for (i=0; i<20; i++)
     mypktptr->payload[i] = packet.payload[i];
-  if (TRACE>2)  {
+  if (TRACING(3))  {
     printf("          TOLAYER3: seq: %d, ack %d, check: %d ", mypktptr->seqnum,
            mypktptr->acknum,  mypktptr->checksum);
     for (i=0; i<20; i++)
       printf("%c",mypktptr->payload[i]);
     printf("\n");
   }
+  tracerecord(s, TR_TOLAYER3, AorB, packet.seqnum, packet.acknum, 0);
 
-  /* create future event for arrival of packet at the other side */
-  evptr = malloc(sizeof(struct event));
-  if (evptr == 0) {
-    printf("memory allocation for event failed.");
-    exit(EXIT_FAILURE);
-  }
   evptr->evtype =  FROM_LAYER3;   /* packet will pop out from layer3 */
   evptr->eventity = (AorB+1) % 2; /* event occurs at other entity */
-  evptr->pktptr = mypktptr;       /* save ptr to my copy of packet */
+  /* a packet held back is not waited for by the ones after it */
+  reordered = cfg->reorderprob > 0.0 && jimsrand(s, RNG_REORDER) < cfg->reorderprob && impaired(cfg, AorB);
+
   /* finally, compute the arrival time of packet at the other end.
      medium can not reorder, so make sure packet arrives between 1 and 10
      time units after the latest arrival time of packets
-     currently in the medium on their way to the destination */
-  lastime = time;
-  /* for (q=evlist; q!=NULL && q->next!=NULL; q = q->next) */
-  for (q=evlist; q!=NULL ; q = q->next) 
-    if ( (q->evtype==FROM_LAYER3  && q->eventity==evptr->eventity) ) 
-      lastime = q->evtime;
-  evptr->evtime =  lastime + 1 + 9*jimsrand();
+     currently in the medium on their way to the destination.  The link
+     keeps packets in order itself, but a replayed delay in place of its
+     propagation delay may not.  One held behind the latest arrival comes
+     at the next float after it, even at time 0, since of two events at
+     the same time the later one goes first */
+  if (cfg->link[AorB].bandwidth > 0.0 || replayed == REPLAY_DELIVERED) {
+    lastime = (cfg->link[AorB].bandwidth > 0.0) ? arrival : s->time + delay;
+    if (e->lastarrival[evptr->eventity] >= lastime)
+      lastime = nextafterf(e->lastarrival[evptr->eventity], HUGE_VALF);
+    evptr->evtime = lastime;
+    if (!reordered)
+      e->lastarrival[evptr->eventity] = evptr->evtime;
+  }
+  else {
+    lastime = s->time;
+    if (e->lastarrival[evptr->eventity] > lastime)
+      lastime = e->lastarrival[evptr->eventity];
+    evptr->evtime =  lastime + 1 + 9*jimsrand(s, RNG_DELAY);
+    if (!reordered)
+      e->lastarrival[evptr->eventity] = evptr->evtime;
+  }
+  if (reordered) {
+    s->nreordered++;
+    evptr->evtime += 2 * cfg->reorderdelay * jimsrand(s, RNG_REORDER);
+    heldadd(s, AorB, evptr->evtime);
+    if (TRACING(1))
+      printf("          TOLAYER3: packet being held back\n");
+    tracerecord(s, TR_REORDER, AorB, packet.seqnum, packet.acknum, 0);
+  }
  
 
 
   /* simulate corruption: */
-  if ((jimsrand() < corruptprob)  && (!(AorB == B && corruptdirection == A) && !(AorB == A && corruptdirection == B))) {
-    ncorrupt++;
-    if ( (x = jimsrand()) < .75)
+  if ((jimsrand(s, RNG_CORRUPT) < corruptprob)  && impaired(cfg, AorB)) {
+    s->ncorrupt++;
+    if ( (x = jimsrand(s, RNG_CORRUPT)) < .75) {
       mypktptr->payload[0]='Z';   /* corrupt payload */
-    else if (x < .875)
+      i = TRF_PAYLOAD;
+    }
+    else if (x < .875) {
       mypktptr->seqnum = 999999;
-    else
+      i = TRF_SEQNUM;
+    }
+    else {
       mypktptr->acknum = 999999;
-    if (TRACE>0)    
+      i = TRF_ACKNUM;
+    }
+    if (TRACING(1))    
       printf("          TOLAYER3: packet being corrupted\n");
+    tracerecord(s, TR_CORRUPT, AorB, packet.seqnum, packet.acknum, i);
   }  
 
-  if (TRACE>2)  
+  if (TRACING(3))  
     printf("          TOLAYER3: scheduling arrival on other side\n");
-  insertevent(evptr);
+  insertevent(s, evptr);
+
+  /* a duplicate arrives within a time unit of the original, corrupted
+     the same way */
+  if (cfg->dupprob > 0.0 && jimsrand(s, RNG_REORDER) < cfg->dupprob && impaired(cfg, AorB)) {
+    s->nduplicated++;
+    if (TRACING(1))
+      printf("          TOLAYER3: packet being duplicated\n");
+    tracerecord(s, TR_DUPLICATE, AorB, packet.seqnum, packet.acknum, 0);
+    dupptr = newevent(e);
+    dupptr->evtype = evptr->evtype;
+    dupptr->eventity = evptr->eventity;
+    dupptr->pkt = evptr->pkt;
+    dupptr->evtime = evptr->evtime + jimsrand(s, RNG_REORDER);
+    heldadd(s, AorB, dupptr->evtime);
+    insertevent(s, dupptr);
+  }
 } 
 
-void tolayer5(int AorB, char datasent[20])
+void tolayer5(struct sim *s, int AorB, char datasent[20])
 {
   int i;  
-  if (TRACE>2) {
+  if (TRACING(3)) {
     printf("          TOLAYER5: data received by application at ");
     if (AorB == A) 
       printf("A: ");
@@ -386,29 +1918,28 @@ void tolayer5(int AorB, char datasent[20])
       printf("%c",datasent[i]);
     printf("\n");
   }
-  messages_delivered++;
+  tracerecord(s, TR_TOLAYER5, AorB, 0, 0, 0);
+  s->messages_delivered++;
 }
 
-int main(void)
+/* run the simulation until no events are left */
+void sim_run(struct sim *s)
 {
+  struct emu *e = s->emu;
   struct event *eventptr;
   struct msg  msg2give;
-  struct pkt  pkt2give;
    
   int i,j;
-  
-  init();
-  A_init();
-  B_init();
-   
+
   while (1) {
-    eventptr = evlist;            /* get next event to simulate */
-    if (eventptr==NULL)
-      goto terminate;
-    evlist = evlist->next;        /* remove this event from event list */
-    if (evlist!=NULL)
-      evlist->prev=NULL;
-    if (TRACE>=2) {
+    eventptr = popevent(s);       /* get next event to simulate */
+    if (eventptr==NULL) {
+      linkfinish(s);
+      lossburst(s, A);
+      lossburst(s, B);
+      return;
+    }
+    if (TRACING(2)) {
       printf("\nEVENT time: %f,",eventptr->evtime);
       printf("  type: %d",eventptr->evtype);
       if (eventptr->evtype==0)
@@ -419,60 +1950,148 @@ int main(void)
         printf(", fromlayer3 ");
       printf(" entity: %d\n",eventptr->eventity);
     }
-    time = eventptr->evtime;        /* update time to next event time */
+    s->time = eventptr->evtime;     /* update time to next event time */
+    if (eventptr->evtype == FROM_LAYER3)
+      tracerecord(s, FROM_LAYER3, eventptr->eventity, eventptr->pkt.seqnum, eventptr->pkt.acknum, 0);
+    else
+      tracerecord(s, eventptr->evtype, eventptr->eventity, 0, 0, 0);
     if (eventptr->evtype == FROM_LAYER5 ) {
-      if (nsim < nsimmax) {
-        generate_next_arrival();   /* set up future arrival */
+      if (s->nsim < s->cfg->nsimmax) {
+        generate_next_arrival(s);  /* set up future arrival */
         /* fill in msg to give with string of same letter */    
-        j = nsim % 26; 
+        j = s->nsim % 26; 
         for (i=0; i<20; i++)  
           msg2give.data[i] = 97 + j;
-        if (TRACE>2) {
+        if (TRACING(3)) {
           printf("          MAINLOOP: data given to student: ");
           for (i=0; i<20; i++) 
             printf("%c", msg2give.data[i]);
           printf("\n");
         }
-        nsim++;
+        s->nsim++;
         if (eventptr->eventity == A) 
-          A_output(msg2give);  
+          A_output(s, msg2give);  
         else
-          B_output(msg2give);  
+          B_output(s, msg2give);  
       }
-      else if (TRACE > 2)
+      else if (TRACING(3))
           printf("          FROM_LAYER5: no more messages to send: \n");
     }
     else if (eventptr->evtype ==  FROM_LAYER3) {
-      pkt2give.seqnum = eventptr->pktptr->seqnum;
-      pkt2give.acknum = eventptr->pktptr->acknum;
-      pkt2give.checksum = eventptr->pktptr->checksum;
-      for (i=0; i<20; i++)  
-        pkt2give.payload[i] = eventptr->pktptr->payload[i];
-	    if (eventptr->eventity ==A)      /* deliver packet by calling */
-        A_input(pkt2give);            /* appropriate entity */
+      if (eventptr->eventity ==A)      /* deliver packet by calling */
+        A_input(s, eventptr->pkt);      /* appropriate entity */
       else
-        B_input(pkt2give);
-	    free(eventptr->pktptr);          /* free the memory for packet */
+        B_input(s, eventptr->pkt);
     }
     else if (eventptr->evtype ==  TIMER_INTERRUPT) {
+      e->pendingtimer[eventptr->eventity] = NULL;   /* timer is no longer running */
       if (eventptr->eventity == A) 
-        A_timerinterrupt();
+        A_timerinterrupt(s);
       else
-        B_timerinterrupt();
+        B_timerinterrupt(s);
     }
     else  {
       printf("INTERNAL PANIC: unknown event type \n");
     }
-    free(eventptr);
+    freeevent(e, eventptr);
   }
+}
+
+void sim_report(struct sim *s)
+{
+  struct emu *e = s->emu;
+  int i, n;
 
- terminate:
-  printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n",time,nsim);
-  printf("number of messages dropped due to full window:  %d \n", window_full);
-  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", new_ACKs);
+  printf(" Simulator terminated at time %f\n after attempting to send %d msgs from layer5\n",s->time,s->nsim);
+  printf("number of messages dropped due to full window:  %d \n", s->window_full);
+  printf("number of valid (not corrupt or duplicate) acknowledgements received at A:  %d \n", s->new_ACKs);
   printf("(note: a single acknowledgement may have acknowledged more than one packet - if cumulative acknowledgements are used)\n");
-  printf("number of packet resends by A:  %d \n", packets_resent);
-  printf("number of correct packets received at B:  %d \n", packets_received);
-  printf("number of messages delivered to application:  %d \n", messages_delivered);
+  printf("number of packet resends by A:  %d \n", s->packets_resent);
+  printf("number of correct packets received at B:  %d \n", s->packets_received);
+  printf("number of messages delivered to application:  %d \n", s->messages_delivered);
+  if (s->cfg->dupacks > 0)
+    printf("number of fast retransmits by A:  %d \n", s->fast_retransmits);
+  if (s->cfg->congestion)
+    printf("final congestion window: %f, cut %d times\n", s->cwnd, s->cwnd_cuts);
+  if (s->cfg->rtomode)
+    printf("final smoothed RTT: %f, retransmission timeout: %f\n", s->srtt, s->rto);
+  for (i = A; i <= B; i++) {
+    if (s->cfg->link[i].bandwidth == 0.0)
+      continue;
+    printf("link %s: %ld packets found %f in the link on average, at most %d, %d dropped by the full queue",
+           (i == A) ? "A->B" : "B->A", e->linkq[i].offered,
+           e->linkq[i].offered ? e->linkq[i].found / e->linkq[i].offered : 0.0,
+           e->linkq[i].peak, e->linkq[i].drops);
+    if (s->cfg->link[i].aqm)
+      printf(", %d by %s", e->linkq[i].aqmdrops, aqms[s->cfg->link[i].aqm].name);
+    printf("\n  time waited in the queue: median %f, 90th percentile %f, 99th percentile %f\n",
+           sojournquantile(&e->linkq[i], &nolink, 0.5), sojournquantile(&e->linkq[i], &nolink, 0.9),
+           sojournquantile(&e->linkq[i], &nolink, 0.99));
+  }
+  if (s->cfg->reorderprob > 0.0 || s->cfg->dupprob > 0.0)
+    printf("packets reordered by the channel: %d, duplicated: %d\n", s->nreordered, s->nduplicated);
+  if (s->cfg->goodbad > 0.0) {
+    printf("loss bursts (runs of losses in either state): %ld, mean length %f\n  packets lost in a row:",
+           e->nbursts, s->lossburst);
+    for (n = BURSTBINS; n > 1 && e->bursts[n-1] == 0; n--)
+      ;
+    for (i = 0; i < n; i++)
+      printf(" %d%s:%d", i + 1, (i == BURSTBINS - 1) ? "+" : "", e->bursts[i]);
+    printf("\n");
+  }
+  printf("event scheduler: %s", e->evq->name);
+  if (e->evq->insert == cq_insert)
+    printf(" (%d days of width %f, resized %d times)", e->cqnbuckets, e->cqwidth, e->cqresizes);
+  printf("\n");
+  printf("random number generator: %s, seed %lu\n", e->rng->name, s->cfg->seed);
+  if (e->tracefp != NULL)
+    printf("binary trace: %ld records\n", e->tracerecs);
+  if (e->replay != NULL)
+    printf("losses and delays replayed from %s\n", s->cfg->replayfile);
+  printf("event pool: %ld events allocated from %d slabs of %d, at most %d in use\n",
+         e->nevallocs, e->nevslabs, EVSLAB, e->nevpeak);
+}
+
+int main(int argc, char *argv[])
+{
+  struct sweep *sweep = NULL;
+  struct sim *s;
+
+  parseargs(argc, argv);
+  /* standard output has the prompts and the protocols' warnings */
+  if (sweepfile != NULL && csvfile == NULL) {
+    printf("a sweep writes its results to the CSV file given with -o\n");
+    return EXIT_FAILURE;
+  }
+  if (sweepfile != NULL)
+    sweep = sweep_load(sweepfile);
+  init();
+  if (replications > 0 || sweep != NULL) {
+    if (config.tracefile != NULL || config.cwndfile != NULL) {
+      printf("a trace can only be written for a single run\n");
+      return EXIT_FAILURE;
+    }
+    if (!sim_threadsafe(&config) && threads != 1) {
+      printf("the %s generator can only run in parallel with -j 1\n", rngs[config.rng].name);
+      return EXIT_FAILURE;
+    }
+  }
+  if (sweep != NULL) {
+    if (replications > 0) {
+      printf("a sweep runs one simulation per cell, sweep the seed instead of -R\n");
+      return EXIT_FAILURE;
+    }
+    run_sweep(sweep, &config, csvfile, threads);
+    sweep_free(sweep);
+    return EXIT_SUCCESS;
+  }
+  if (replications > 0) {
+    run_replications(&config, replications, threads);
+    return EXIT_SUCCESS;
+  }
+  s = sim_create(&config);
+  sim_run(s);
+  sim_report(s);
+  sim_destroy(s);
   return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
@@ -1,11 +1,14 @@
 extern int TRACE;
 
-/* statistics updated by GBN */
-extern int total_ACKs_received;
-extern int packets_resent;       /* count of the number of packets resent  */
-extern int new_ACKs;      /* count of the number of acks correctly received */
-extern int packets_received;  /* count of the packets received by receiver */
-extern int window_full; /* count of the number of messages dropped due to full window */
+/* TRACE_MAX is the highest trace level compiled into the program.  Tracing
+   above it is removed at compile time, so a benchmark build made with
+   -DTRACE_MAX=0 pays nothing for tracing.  Below the ceiling the level is
+   still chosen at runtime through TRACE.  Use as
+     if (TRACING(2)) printf(...);                                         */
+#ifndef TRACE_MAX
+#define TRACE_MAX 4
+#endif
+#define TRACING(level) ((level) <= TRACE_MAX && TRACE >= (level))
 
 #define   A    0
 #define   B    1
@@ -27,14 +30,151 @@ struct pkt {
   char payload[20];
 };
 
+/* one direction of the channel.  Without a bandwidth it is the original
+   channel, which delivers each packet 1 to 10 time units after the one
+   before it.  With one, packets are sent one at a time at that rate from
+   a FIFO queue and arrive after the propagation delay.  The queue drops
+   packets when it is full and, with active queue management, earlier */
+struct link {
+  double bandwidth;       /* bytes per time unit, 0 for the original channel */
+  double delay;           /* propagation delay */
+  int queue;              /* packets waiting besides the one being sent, 0 for no limit */
+  int aqm;                /* queue management, index into the emulator's table, 0 for tail drop */
+};
+
+/* the parameters of a simulation, given on the command line, in a config
+   file or at the interactive prompts */
+struct simconfig {
+  int nsimmax;            /* number of msgs to generate, then stop */
+  float lossprob;         /* probability that a packet is dropped  */
+  float corruptprob;      /* probability that one bit is packet is flipped */
+  int corruptdirection;   /* A->B A<-B or bidirectional corruption/loss */
+  float lambda;           /* arrival rate of messages from layer 5 */
+  unsigned long seed;     /* random number seed */
+  int scheduler;          /* event scheduler, index into the emulator's table */
+  int rng;                /* random number generator, index into the emulator's table */
+  const char *tracefile;  /* binary trace file, NULL for none */
+
+  /* protocol parameters, 0 when the protocol's own default applies */
+  int windowsize;
+  int seqspace;           /* number of sequence numbers */
+  double rtt;             /* the initial timeout when it is adaptive */
+  int rtomode;            /* 0 fixed retransmission timeout, 1 adaptive */
+  int dupacks;            /* duplicate ACKs that trigger a fast retransmit, 0 for none */
+  int sack;               /* 1 if ACKs carry a selective acknowledgement bitmap */
+  int congestion;         /* congestion control, index into cc.c's table, 0 for none */
+  const char *cwndfile;   /* congestion window time series, NULL for none */
+
+  struct link link[2];    /* channel from A and from B */
+
+  /* Gilbert-Elliott channel: each direction is in a good or a bad state,
+     which changes before every packet.  The good state loses and
+     corrupts packets with lossprob and corruptprob, the bad one with
+     badloss and badcorrupt */
+  double goodbad;         /* probability of turning bad, 0 for independent losses */
+  double badgood;         /* probability of turning good again, above 0 */
+  float badloss;
+  float badcorrupt;
+
+  const char *replayfile; /* loss and delay trace replayed instead of the random channel, NULL for none */
+
+  /* impairments that break the channel's in-order delivery */
+  float reorderprob;      /* probability that a packet is held back and overtaken */
+  double reorderdelay;    /* mean time a held back packet is delayed by */
+  float dupprob;          /* probability that a packet arrives twice */
+  int reorderdepth;       /* most packets sent after a held back or duplicated
+                             one that may arrive before it */
+};
+
+struct emu;   /* emulator state, private to emulator.c */
+
+/* one simulation.  Every routine below and every protocol entry point
+   takes the simulation it acts on, so any number of simulations can
+   exist side by side.  TRACE is shared by all of them. */
+struct sim {
+  const struct simconfig *cfg;
+
+  float time;             /* current simulation time */
+
+  /* statistics updated by the protocol */
+  int window_full;        /* count of the number of messages dropped due to full window */
+  int total_ACKs_received;
+  int packets_resent;     /* count of the number of packets resent  */
+  int new_ACKs;           /* count of the number of acks correctly received */
+  int packets_received;   /* count of the packets received by receiver */
+  double srtt;            /* smoothed round trip time, adaptive timeouts only */
+  double rto;             /* retransmission timeout in use */
+  int fast_retransmits;   /* retransmissions triggered by duplicate ACKs */
+  double cwnd;            /* congestion window, with congestion control only */
+  int cwnd_cuts;          /* times the congestion window was cut */
+
+  /* statistics updated by the emulator */
+  int nsim;               /* number of messages from 5 to 4 so far */
+  int messages_delivered; /* number of messages passed up to layer 5 */
+  int ntolayer3;          /* number sent into layer 3 */
+  int nlost;              /* number lost in media */
+  int ncorrupt;           /* number corrupted by media*/
+  int nreordered;         /* number held back so that later ones overtake them */
+  int nduplicated;        /* number delivered twice */
+  int nqueuedrop;         /* number dropped by a full link queue */
+  double queuemean;       /* mean packets a packet found in its link */
+  int naqmdrop;           /* number dropped by active queue management */
+  double sojourn50;       /* median time packets waited in a link queue */
+  double sojourn99;       /* 99th percentile of that time */
+  double lossburst;       /* mean number of packets lost in a row, in either channel state */
+
+  /* protocol state of A and B.  Each is allocated by A_init()/B_init() as
+     a single block, which the emulator frees with the simulation */
+  void *A_state;
+  void *B_state;
+
+  struct emu *emu;
+};
+
 /* send to A or B (int), packet to send */
-extern void tolayer3(int, struct pkt);  
+extern void tolayer3(struct sim *, int, struct pkt);
 
 /* deliver to A or B (int), data to deliver */
-extern void tolayer5(int, char[20]); 
+extern void tolayer5(struct sim *, int, char[20]);
 
 /* start timer at A or B (int), increment */
-extern void starttimer(int, double);       
+extern void starttimer(struct sim *, int, double);
 
 /* stop timer at A or B (int) */
-extern void stoptimer(int);               
+extern void stoptimer(struct sim *, int);
+
+/* note the congestion window of A or B (int) for the time series
+   written with "-W file".  Does nothing without one */
+extern void recordcwnd(struct sim *, int, double cwnd, double ssthresh);
+
+/* create a simulation, run it until no events are left, print the
+   termination statistics and free it */
+extern struct sim *sim_create(const struct simconfig *);
+extern void sim_run(struct sim *);
+extern void sim_report(struct sim *);
+extern void sim_destroy(struct sim *);
+
+/* returns false if simulations with this configuration share state and
+   must not run on several threads at once */
+extern int sim_threadsafe(const struct simconfig *);
+
+/* the most packets sent after a packet that may arrive before it, 0 if
+   the channel keeps every direction in order.  A protocol must widen its
+   sequence space by this many numbers, or a late packet could come back
+   after its number was reused */
+extern int sim_reorderdepth(const struct simconfig *);
+
+/* set the parameter with this config file key in cfg, returns 0 if there
+   is no such simulation parameter or the value is invalid.  It does not
+   count as given, a parameter only swept is still prompted for */
+extern int simconfig_set(struct simconfig *, const char *key, const char *value);
+
+/* free the file names simconfig_set() saved in cfg since it was copied
+   from the configuration from */
+extern void simconfig_release(struct simconfig *cfg, const struct simconfig *from);
+
+/* helpers for reading config and sweep files: a malloc()ed copy of a
+   string, NULL if out of memory, and a string with the blanks at both
+   ends cut off in place */
+extern char *emu_savestring(const char *);
+extern char *emu_trim(char *);
@@ -1,7 +1,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <limits.h>
 #include "emulator.h"
+#include "rto.h"
+#include "cc.h"
 #include "gbn.h"
 
 /* ******************************************************************
@@ -14,7 +17,8 @@
    - packets can be corrupted (either the header or the data portion)
    or lost, according to user-defined probabilities
    - packets will be delivered in the order in which they were sent
-   (although some can be lost).
+   (although some can be lost), unless reordering or duplication is
+   turned on with "-e" or "-u".
 
    Modifications:
    - removed bidirectional GBN code and other code not used by prac.
@@ -23,11 +27,18 @@
 **********************************************************************/
 
 #define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
-#define WINDOWSIZE 6    /* the maximum number of buffered unacked packet
+#define WINDOWSIZE 6    /* the default number of buffered unacked packet
                           MUST BE SET TO 6 when submitting assignment */
-#define SEQSPACE 7      /* the min sequence space for GBN must be at least windowsize + 1 */
+                        /* the sequence space defaults to the least GBN allows, windowsize + 1,
+                           or to 2*windowsize with selective acknowledgements */
 #define NOTINUSE (-1)   /* used to fill header fields that are not being used */
 
+/* with selective acknowledgements (-k 1) the payload of an ACK is a
+   bitmap: bit i (bit i%8 of payload[i/8]) is set if B holds packet
+   acknum+1+i.  The checksum covers it like any payload */
+#define SACKBITS 160
+#define SACKED(packet, i) ((i) < SACKBITS && ((packet).payload[(i) / 8] >> ((i) % 8)) & 1)
+
 /* generic procedure to compute the checksum of a packet.  Used by both sender and receiver
    the simulator will overwrite part of your packet with 'z's.  It will not overwrite your
    original checksum.  This procedure must generate a different checksum to the original if
@@ -57,24 +68,102 @@ bool IsCorrupted(struct pkt packet)
 
 /********* Sender (A) variables and functions ************/
 
-static struct pkt buffer[WINDOWSIZE];  /* array for storing packets waiting for ACK */
-static int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
-static int windowcount;                /* the number of packets currently awaiting an ACK */
-static int A_nextseqnum;               /* the next sequence number to be used by the sender */
+/* the window size and sequence space given at startup, if any.  Exits
+   if GBN cannot tell the packets of one window from the next */
+static void getwindow(struct sim *s, int *windowsize, int *seqspace)
+{
+  int least;
+
+  *windowsize = (s->cfg->windowsize > 0) ? s->cfg->windowsize : WINDOWSIZE;
+  if (*windowsize > INT_MAX / 4) {
+    printf("window size %d is too large\n", *windowsize);
+    exit(EXIT_FAILURE);
+  }
+  /* a late packet or ACK can be overtaken by the next depth packets
+     sent after it, and must not find its number reused by then */
+  least = *windowsize + 1 + sim_reorderdepth(s->cfg);
+  if (s->cfg->seqspace > 0)
+    *seqspace = s->cfg->seqspace;
+  else if (s->cfg->sack)   /* room for B to hold a whole window */
+    *seqspace = *windowsize + least - 1;
+  else
+    *seqspace = least;
+  if (*seqspace < least || *seqspace > INT_MAX / 2) {
+    printf("a sequence space of %d does not suit a window of %d, GBN needs at least %d\n",
+           *seqspace, *windowsize, least);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* The sender and receiver state are each a single block, as the
+   emulator frees them with free(): the struct followed by the arrays
+   its pointers refer to, largest alignment first */
+
+struct sender {
+  struct pkt *buffer;             /* array for storing packets waiting for ACK */
+  int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
+  int windowcount;                /* the number of packets currently awaiting an ACK */
+  int nextseqnum;                 /* the next sequence number to be used by the sender */
+  int windowsize;                 /* window size, and the size of the arrays */
+  int seqspace;                   /* number of sequence numbers */
+  struct rto rto;                 /* retransmission timeout */
+  struct cc cc;                   /* congestion window */
+  double *sendtime;               /* when each buffered packet was last sent */
+  bool *resent;                   /* the packet was resent, so its ACK gives no RTT sample */
+  int dupacks;                    /* duplicate ACKs in a row for the packet before the window */
+  bool *sacked;                   /* B holds the packet, it need not be resent */
+};
+
+/* publish the congestion window in the statistics and its time series */
+static void showcc(struct sim *s, struct cc *c)
+{
+  if (!c->enabled)
+    return;
+  s->cwnd = c->cwnd;
+  s->cwnd_cuts = c->cuts;
+  recordcwnd(s, A, c->cwnd, c->ssthresh);
+}
+
+/* mark the packets that the bitmap of an ACK says B holds */
+static void readsack(struct sim *s, struct pkt packet)
+{
+  struct sender *a = s->A_state;
+  int i;
+
+  /* the bitmap starts just after the acknowledged packet */
+  if (!s->cfg->sack || a->windowcount == 0
+      || a->buffer[a->windowfirst].seqnum != (packet.acknum + 1) % a->seqspace)
+    return;
+  for (i = 0; i < a->windowcount; i++)
+    if (SACKED(packet, i) && !a->sacked[(a->windowfirst + i) % a->windowsize]) {
+      if (TRACING(2))
+        printf("----A: packet %d is held by B, do not resend it!\n",
+               a->buffer[(a->windowfirst + i) % a->windowsize].seqnum);
+      a->sacked[(a->windowfirst + i) % a->windowsize] = true;
+    }
+}
+
+/* publish the timeout estimate in the statistics */
+static void showrto(struct sim *s, struct rto *r)
+{
+  s->srtt = r->srtt;
+  s->rto = r->timeout;
+}
 
 /* called from layer 5 (application layer), passed the message to be sent to other side */
-void A_output(struct msg message)
+void A_output(struct sim *s, struct msg message)
 {
+  struct sender *a = s->A_state;
   struct pkt sendpkt;
   int i;
 
   /* if not blocked waiting on ACK */
-  if ( windowcount < WINDOWSIZE) {
-    if (TRACE > 1)
+  if ( a->windowcount < a->windowsize && cc_cansend(&a->cc, a->windowcount, s->time)) {
+    if (TRACING(2))
       printf("----A: New message arrives, send window is not full, send new message to layer3!\n");
 
     /* create packet */
-    sendpkt.seqnum = A_nextseqnum;
+    sendpkt.seqnum = a->nextseqnum;
     sendpkt.acknum = NOTINUSE;
     for ( i=0; i<20 ; i++ )
       sendpkt.payload[i] = message.data[i];
@@ -82,27 +171,31 @@ void A_output(struct msg message)
 
     /* put packet in window buffer */
     /* windowlast will always be 0 for alternating bit; but not for GoBackN */
-    windowlast = (windowlast + 1) % WINDOWSIZE;
-    buffer[windowlast] = sendpkt;
-    windowcount++;
+    a->windowlast = (a->windowlast + 1) % a->windowsize;
+    a->buffer[a->windowlast] = sendpkt;
+    a->sendtime[a->windowlast] = s->time;
+    a->resent[a->windowlast] = false;
+    a->sacked[a->windowlast] = false;
+    a->windowcount++;
 
     /* send out packet */
-    if (TRACE > 0)
+    if (TRACING(1))
       printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-    tolayer3 (A, sendpkt);
+    tolayer3(s, A, sendpkt);
+    cc_sent(&a->cc, s->time);
 
     /* start timer if first packet in window */
-    if (windowcount == 1)
-      starttimer(A,RTT);
+    if (a->windowcount == 1)
+      starttimer(s, A, a->rto.timeout);
 
     /* get next sequence number, wrap back to 0 */
-    A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;
+    a->nextseqnum = (a->nextseqnum + 1) % a->seqspace;
   }
   /* if blocked,  window is full */
   else {
-    if (TRACE > 0)
+    if (TRACING(1))
       printf("----A: New message arrives, send window is full\n");
-    window_full++;
+    s->window_full++;
   }
 }
 
@@ -110,75 +203,132 @@ void A_output(struct msg message)
 /* called from layer 3, when a packet arrives for layer 4
    In this practical this will always be an ACK as B never sends data.
 */
-void A_input(struct pkt packet)
+void A_input(struct sim *s, struct pkt packet)
 {
+  struct sender *a = s->A_state;
   int ackcount = 0;
+  bool timed;
   int i;
 
   /* if received ACK is not corrupted */
   if (!IsCorrupted(packet)) {
-    if (TRACE > 0)
+    if (TRACING(1))
       printf("----A: uncorrupted ACK %d is received\n",packet.acknum);
-    total_ACKs_received++;
+    s->total_ACKs_received++;
 
     /* check if new ACK or duplicate */
-    if (windowcount != 0) {
-          int seqfirst = buffer[windowfirst].seqnum;
-          int seqlast = buffer[windowlast].seqnum;
+    if (a->windowcount != 0) {
+          int seqfirst = a->buffer[a->windowfirst].seqnum;
+          int seqlast = a->buffer[a->windowlast].seqnum;
           /* check case when seqnum has and hasn't wrapped */
           if (((seqfirst <= seqlast) && (packet.acknum >= seqfirst && packet.acknum <= seqlast)) ||
               ((seqfirst > seqlast) && (packet.acknum >= seqfirst || packet.acknum <= seqlast))) {
 
             /* packet is a new ACK */
-            if (TRACE > 0)
+            if (TRACING(1))
               printf("----A: ACK %d is not a duplicate\n",packet.acknum);
-            new_ACKs++;
+            s->new_ACKs++;
+            a->dupacks = 0;
 
             /* cumulative acknowledgement - determine how many packets are ACKed */
             if (packet.acknum >= seqfirst)
               ackcount = packet.acknum + 1 - seqfirst;
             else
-              ackcount = SEQSPACE - seqfirst + packet.acknum;
+              ackcount = a->seqspace - seqfirst + packet.acknum;
+
+            /* time the packet ACKed, unless it was resent (Karn's rule)
+               or B held it already, then the ACK came late for it */
+            i = (a->windowfirst + ackcount - 1) % a->windowsize;
+            timed = !a->resent[i] && !a->sacked[i];
+            if (timed) {
+              rto_sample(&a->rto, s->time - a->sendtime[i]);
+              showrto(s, &a->rto);
+            }
+
+            cc_ack(&a->cc, s->time, ackcount, timed ? s->time - a->sendtime[i] : -1.0);
+            showcc(s, &a->cc);
 
 	    /* slide window by the number of packets ACKed */
-            windowfirst = (windowfirst + ackcount) % WINDOWSIZE;
+            a->windowfirst = (a->windowfirst + ackcount) % a->windowsize;
 
             /* delete the acked packets from window buffer */
             for (i=0; i<ackcount; i++)
-              windowcount--;
+              a->windowcount--;
 
 	    /* start timer again if there are still more unacked packets in window */
-            stoptimer(A);
-            if (windowcount > 0)
-              starttimer(A, RTT);
+            stoptimer(s, A);
+            if (a->windowcount > 0)
+              starttimer(s, A, a->rto.timeout);
 
+            readsack(s, packet);
+          }
+          /* B repeats the ACK of the packet before the window when one
+             in the window is lost, go back without waiting for the timer */
+          else {
+            readsack(s, packet);
+            if (s->cfg->dupacks > 0 && packet.acknum == (seqfirst + a->seqspace - 1) % a->seqspace
+                && ++a->dupacks == s->cfg->dupacks) {
+              if (TRACING(1))
+                printf ("----A: %d duplicate ACKs received, fast retransmit!\n", a->dupacks);
+              s->fast_retransmits++;
+              cc_loss(&a->cc, s->time, a->sendtime[a->windowfirst]);
+              showcc(s, &a->cc);
+              for (i=0; i<a->windowcount; i++) {
+                if (i > 0 && a->sacked[(a->windowfirst+i) % a->windowsize])
+                  continue;
+                if (TRACING(1))
+                  printf ("---A: resending packet %d\n", (a->buffer[(a->windowfirst+i) % a->windowsize]).seqnum);
+                tolayer3(s, A, a->buffer[(a->windowfirst+i) % a->windowsize]);
+                a->sendtime[(a->windowfirst+i) % a->windowsize] = s->time;
+                a->resent[(a->windowfirst+i) % a->windowsize] = true;
+                s->packets_resent++;
+              }
+              stoptimer(s, A);
+              starttimer(s, A, a->rto.timeout);
+            }
           }
         }
         else
-          if (TRACE > 0)
+          if (TRACING(1))
         printf ("----A: duplicate ACK received, do nothing!\n");
   }
   else
-    if (TRACE > 0)
+    if (TRACING(1))
       printf ("----A: corrupted ACK is received, do nothing!\n");
 }
 
 /* called when A's timer goes off */
-void A_timerinterrupt(void)
+void A_timerinterrupt(struct sim *s)
 {
+  struct sender *a = s->A_state;
   int i;
 
-  if (TRACE > 0)
+  if (TRACING(1))
     printf("----A: time out,resend packets!\n");
 
-  for(i=0; i<windowcount; i++) {
+  /* back off before the timer is started again */
+  rto_backoff(&a->rto);
+  showrto(s, &a->rto);
+  if (a->windowcount > 0) {
+    cc_timeout(&a->cc, s->time, a->sendtime[a->windowfirst]);
+    showcc(s, &a->cc);
+  }
+
+  for(i=0; i<a->windowcount; i++) {
 
-    if (TRACE > 0)
-      printf ("---A: resending packet %d\n", (buffer[(windowfirst+i) % WINDOWSIZE]).seqnum);
+    /* B holds it already.  The first packet is always resent, it is
+       the one B is waiting for */
+    if (i > 0 && a->sacked[(a->windowfirst+i) % a->windowsize])
+      continue;
 
-    tolayer3(A,buffer[(windowfirst+i) % WINDOWSIZE]);
-    packets_resent++;
-    if (i==0) starttimer(A,RTT);
+    if (TRACING(1))
+      printf ("---A: resending packet %d\n", (a->buffer[(a->windowfirst+i) % a->windowsize]).seqnum);
+
+    tolayer3(s, A,a->buffer[(a->windowfirst+i) % a->windowsize]);
+    a->sendtime[(a->windowfirst+i) % a->windowsize] = s->time;
+    a->resent[(a->windowfirst+i) % a->windowsize] = true;
+    s->packets_resent++;
+    if (i==0) starttimer(s, A, a->rto.timeout);
   }
 }
 
@@ -186,78 +336,165 @@ void A_timerinterrupt(void)
 
 /* the following routine will be called once (only) before any other */
 /* entity A routines are called. You can use it to do any initialization */
-void A_init(void)
+void A_init(struct sim *s)
 {
+  struct sender *a;
+  int windowsize, seqspace;
+
+  getwindow(s, &windowsize, &seqspace);
+  a = malloc(sizeof(struct sender)
+             + windowsize * (sizeof(double) + sizeof(struct pkt) + 2 * sizeof(bool)));
+  if (a == NULL) {
+    printf("memory allocation for sender failed.");
+    exit(EXIT_FAILURE);
+  }
+  s->A_state = a;
+  a->windowsize = windowsize;
+  a->seqspace = seqspace;
+  a->sendtime = (double *)(a + 1);
+  a->buffer = (struct pkt *)(a->sendtime + windowsize);
+  a->resent = (bool *)(a->buffer + windowsize);
+  a->sacked = a->resent + windowsize;
+
   /* initialise A's window, buffer and sequence number */
-  A_nextseqnum = 0;  /* A starts with seq num 0, do not change this */
-  windowfirst = 0;
-  windowlast = -1;   /* windowlast is where the last packet sent is stored.
+  a->nextseqnum = 0;  /* A starts with seq num 0, do not change this */
+  a->windowfirst = 0;
+  a->windowlast = -1;   /* windowlast is where the last packet sent is stored.
 		     new packets are placed in winlast + 1
 		     so initially this is set to -1
 		   */
-  windowcount = 0;
+  a->windowcount = 0;
+  a->dupacks = 0;
+
+  /* use the timeout given at startup, if any */
+  rto_init(&a->rto, s->cfg->rtomode, (s->cfg->rtt > 0.0) ? s->cfg->rtt : RTT);
+  showrto(s, &a->rto);
+  cc_init(&a->cc, s->cfg->congestion, windowsize);
+  showcc(s, &a->cc);
 }
 
 
 
 /********* Receiver (B)  variables and procedures ************/
 
-static int expectedseqnum; /* the sequence number expected next by the receiver */
-static int B_nextseqnum;   /* the sequence number for the next packets sent by B */
+struct receiver {
+  int expectedseqnum; /* the sequence number expected next by the receiver */
+  int nextseqnum;     /* the sequence number for the next packets sent by B */
+
+  /* with selective acknowledgements B keeps packets that arrive ahead of
+     expectedseqnum.  Only rcvwindow sequence numbers past it can be told
+     apart from resent or late packets that were delivered already */
+  int rcvwindow;
+  int seqspace;         /* number of sequence numbers, and the size of the arrays */
+  struct pkt *buffer;   /* packets held, by sequence number */
+  bool *received;       /* buffer[seqnum] holds a packet */
+};
 
 
 /* called from layer 3, when a packet arrives for layer 4 at B*/
-void B_input(struct pkt packet)
+void B_input(struct sim *s, struct pkt packet)
 {
+  struct receiver *b = s->B_state;
   struct pkt sendpkt;
   int i;
 
   /* if not corrupted and received packet is in order */
-  if  ( (!IsCorrupted(packet))  && (packet.seqnum == expectedseqnum) ) {
-    if (TRACE > 0)
+  if  ( (!IsCorrupted(packet))  && (packet.seqnum == b->expectedseqnum) ) {
+    if (TRACING(1))
       printf("----B: packet %d is correctly received, send ACK!\n",packet.seqnum);
-    packets_received++;
+    s->packets_received++;
 
     /* deliver to receiving application */
-    tolayer5(B, packet.payload);
+    tolayer5(s, B, packet.payload);
 
     /* send an ACK for the received packet */
-    sendpkt.acknum = expectedseqnum;
+    sendpkt.acknum = b->expectedseqnum;
 
     /* update state variables */
-    expectedseqnum = (expectedseqnum + 1) % SEQSPACE;
+    b->expectedseqnum = (b->expectedseqnum + 1) % b->seqspace;
+
+    /* deliver the packets held that now follow in order */
+    while (b->received[b->expectedseqnum]) {
+      tolayer5(s, B, b->buffer[b->expectedseqnum].payload);
+      b->received[b->expectedseqnum] = false;
+      sendpkt.acknum = b->expectedseqnum;
+      b->expectedseqnum = (b->expectedseqnum + 1) % b->seqspace;
+    }
+  }
+  else if (s->cfg->sack && !IsCorrupted(packet)
+           && (packet.seqnum - b->expectedseqnum + b->seqspace) % b->seqspace < b->rcvwindow
+           && !b->received[packet.seqnum]) {
+    /* packet is ahead of the one expected, hold it and resend last ACK */
+    if (TRACING(1))
+      printf("----B: packet %d is out of order, hold it and resend ACK!\n",packet.seqnum);
+    s->packets_received++;
+    b->buffer[packet.seqnum] = packet;
+    b->received[packet.seqnum] = true;
+    sendpkt.acknum = (b->expectedseqnum + b->seqspace - 1) % b->seqspace;
   }
   else {
     /* packet is corrupted or out of order resend last ACK */
-    if (TRACE > 0)
+    if (TRACING(1))
       printf("----B: packet corrupted or not expected sequence number, resend ACK!\n");
-    if (expectedseqnum == 0)
-      sendpkt.acknum = SEQSPACE - 1;
+    if (b->expectedseqnum == 0)
+      sendpkt.acknum = b->seqspace - 1;
     else
-      sendpkt.acknum = expectedseqnum - 1;
+      sendpkt.acknum = b->expectedseqnum - 1;
   }
 
   /* create packet */
-  sendpkt.seqnum = B_nextseqnum;
-  B_nextseqnum = (B_nextseqnum + 1) % 2;
+  sendpkt.seqnum = b->nextseqnum;
+  b->nextseqnum = (b->nextseqnum + 1) % 2;
 
-  /* we don't have any data to send.  fill payload with 0's */
-  for ( i=0; i<20 ; i++ )
-    sendpkt.payload[i] = '0';
+  /* we don't have any data to send.  fill payload with 0's, or with
+     the bitmap of the packets held */
+  if (s->cfg->sack) {
+    for ( i=0; i<20 ; i++ )
+      sendpkt.payload[i] = 0;
+    for ( i=0; i<b->rcvwindow && i<SACKBITS; i++ )
+      if (b->received[(b->expectedseqnum + i) % b->seqspace])
+        sendpkt.payload[i / 8] |= 1 << (i % 8);
+  }
+  else
+    for ( i=0; i<20 ; i++ )
+      sendpkt.payload[i] = '0';
 
   /* computer checksum */
   sendpkt.checksum = ComputeChecksum(sendpkt);
 
   /* send out packet */
-  tolayer3 (B, sendpkt);
+  tolayer3(s, B, sendpkt);
 }
 
 /* the following routine will be called once (only) before any other */
 /* entity B routines are called. You can use it to do any initialization */
-void B_init(void)
+void B_init(struct sim *s)
 {
-  expectedseqnum = 0;
-  B_nextseqnum = 1;
+  struct receiver *b;
+  int windowsize, seqspace;
+  int i;
+
+  getwindow(s, &windowsize, &seqspace);
+  b = malloc(sizeof(struct receiver) + seqspace * (sizeof(struct pkt) + sizeof(bool)));
+  if (b == NULL) {
+    printf("memory allocation for receiver failed.");
+    exit(EXIT_FAILURE);
+  }
+  s->B_state = b;
+  b->seqspace = seqspace;
+  b->buffer = (struct pkt *)(b + 1);
+  b->received = (bool *)(b->buffer + seqspace);
+  b->expectedseqnum = 0;
+  b->nextseqnum = 1;
+
+  b->rcvwindow = windowsize;
+  if (b->rcvwindow > b->seqspace - windowsize - sim_reorderdepth(s->cfg))
+    b->rcvwindow = b->seqspace - windowsize - sim_reorderdepth(s->cfg);
+  if (s->cfg->sack && b->rcvwindow <= 1)
+    printf("Warning: with a sequence space of %d B cannot hold any packet, selective acknowledgements have no effect\n",
+           b->seqspace);
+  for (i = 0; i < b->seqspace; i++)
+    b->received[i] = false;
 }
 
 /******************************************************************************
@@ -265,11 +502,11 @@ void B_init(void)
  *****************************************************************************/
 
 /* Note that with simplex transfer from a-to-B, there is no B_output() */
-void B_output(struct msg message)
+void B_output(struct sim *s, struct msg message)
 {
 }
 
 /* called when B's timer goes off */
-void B_timerinterrupt(void)
+void B_timerinterrupt(struct sim *s)
 {
 }
@@ -1,11 +1,11 @@
-extern void A_init(void);
-extern void B_init(void);
-extern void A_input(struct pkt);
-extern void B_input(struct pkt);
-extern void A_output(struct msg);
-extern void A_timerinterrupt(void);
+extern void A_init(struct sim *);
+extern void B_init(struct sim *);
+extern void A_input(struct sim *, struct pkt);
+extern void B_input(struct sim *, struct pkt);
+extern void A_output(struct sim *, struct msg);
+extern void A_timerinterrupt(struct sim *);
 
 /* included for extension to bidirectional communication */
 #define BIDIRECTIONAL 0       /*  0 = A->B  1 =  A<->B */
-extern void B_output(struct msg);
-extern void B_timerinterrupt(void);
\ No newline at end of file
+extern void B_output(struct sim *, struct msg);
+extern void B_timerinterrupt(struct sim *);
\ No newline at end of file
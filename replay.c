@@ -0,0 +1,194 @@
+#define _POSIX_C_SOURCE 200112L
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "emulator.h"
+#include "replay.h"
+
+/* ******************************************************************
+   Loss and delay trace replay.  Each direction has a cursor with its
+   own window of the file mapped, which moves on as the cursor reaches
+   its end.
+**********************************************************************/
+
+#define WINDOW  (64L << 20)   /* bytes of the file a cursor maps at once */
+#define LINEMAX 256           /* longest line accepted */
+
+#define UNSEEN 0              /* no line for the direction read yet */
+#define FOUND  1
+#define ABSENT 2              /* the trace has no lines for it */
+
+struct cursor {
+  const char *map;            /* mapped window, NULL if none */
+  off_t base;                 /* file offset of the window */
+  size_t len;                 /* bytes mapped */
+  off_t pos;                  /* file offset of the next line */
+  long lineno;                /* number of the next line */
+  int state;
+};
+
+struct replay {
+  const char *path;
+  int fd;
+  off_t size;                 /* bytes in the file */
+  long pagesize;
+  struct cursor cur[2];       /* lines of A and of B */
+};
+
+/* map the window of the file that starts at the page holding pos */
+static void mapwindow(struct replay *r, struct cursor *c, off_t pos)
+{
+  void *p;
+
+  if (c->map != NULL)
+    munmap((void *)c->map, c->len);
+  c->base = pos - pos % r->pagesize;
+  c->len = (r->size - c->base < WINDOW) ? (size_t)(r->size - c->base) : (size_t)WINDOW;
+  p = mmap(NULL, c->len, PROT_READ, MAP_PRIVATE, r->fd, c->base);
+  if (p == MAP_FAILED) {
+    printf("unable to map replay file %s\n", r->path);
+    exit(EXIT_FAILURE);
+  }
+  posix_madvise(p, c->len, POSIX_MADV_SEQUENTIAL);
+  c->map = p;
+}
+
+/* copy the line at the cursor into buf and move past it, returns 0 at
+   the end of the file */
+static int readline(struct replay *r, struct cursor *c, char *buf)
+{
+  const char *p, *nl;
+  size_t avail, n;
+
+  if (c->pos >= r->size)
+    return 0;
+  if (c->map == NULL || c->pos < c->base || c->pos >= c->base + (off_t)c->len)
+    mapwindow(r, c, c->pos);
+  p = c->map + (c->pos - c->base);
+  avail = c->len - (size_t)(c->pos - c->base);
+  nl = memchr(p, '\n', avail);
+
+  /* the line runs past the window, move the window to it */
+  if (nl == NULL && c->base + (off_t)c->len < r->size) {
+    mapwindow(r, c, c->pos);
+    p = c->map + (c->pos - c->base);
+    avail = c->len - (size_t)(c->pos - c->base);
+    nl = memchr(p, '\n', avail);
+  }
+
+  n = (nl != NULL) ? (size_t)(nl - p) : avail;
+  c->lineno++;
+  if (n >= LINEMAX || (nl == NULL && c->base + (off_t)c->len < r->size)) {
+    printf("%s:%ld: line too long\n", r->path, c->lineno);
+    exit(EXIT_FAILURE);
+  }
+  memcpy(buf, p, n);
+  buf[n] = '\0';
+  c->pos += n + (nl != NULL);
+  return 1;
+}
+
+/* the next word at *p, NULL if there is none.  Not strtok(), which
+   simulations on other threads would share */
+static char *nextword(char **p)
+{
+  char *word = *p + strspn(*p, " \t\r");
+
+  if (*word == '\0')
+    return NULL;
+  *p = word + strcspn(word, " \t\r");
+  if (**p != '\0')
+    *(*p)++ = '\0';
+  return word;
+}
+
+/* parse a line into the sender and the delay, negative if the packet is
+   lost.  Returns 0 for a blank line or a comment */
+static int parseline(struct replay *r, struct cursor *c, char *line, int *AorB, double *delay)
+{
+  char *word, *end;
+
+  word = nextword(&line);
+  if (word == NULL || word[0] == '#')
+    return 0;
+  if (strcmp(word, "A") == 0)
+    *AorB = A;
+  else if (strcmp(word, "B") == 0)
+    *AorB = B;
+  else
+    word = NULL;
+  if (word != NULL && (word = nextword(&line)) != NULL) {
+    if (strcmp(word, "lost") == 0 || strcmp(word, "-") == 0)
+      *delay = -1.0;
+    else if (!isfinite(*delay = strtod(word, &end)) || *delay < 0.0
+             || end == word || *end != '\0')   /* no "nan" or "inf" either */
+      word = NULL;
+  }
+  if (word == NULL || nextword(&line) != NULL) {
+    printf("%s:%ld: expected A or B and a delay or \"lost\"\n", r->path, c->lineno);
+    exit(EXIT_FAILURE);
+  }
+  return 1;
+}
+
+struct replay *replay_open(const char *path)
+{
+  struct replay *r;
+  struct stat st;
+
+  r = calloc(1, sizeof(struct replay));
+  if (r == NULL) {
+    printf("memory allocation for replay failed.");
+    exit(EXIT_FAILURE);
+  }
+  r->path = path;
+  if ((r->fd = open(path, O_RDONLY)) < 0 || fstat(r->fd, &st) != 0) {
+    printf("unable to open replay file %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+  r->size = st.st_size;
+  r->pagesize = sysconf(_SC_PAGESIZE);
+  return r;
+}
+
+int replay_next(struct replay *r, int AorB, double *delay)
+{
+  struct cursor *c = &r->cur[AorB];
+  char line[LINEMAX];
+  int who;
+
+  while (c->state != ABSENT) {
+    if (!readline(r, c, line)) {
+      /* the whole file was read without a line for AorB */
+      if (c->state == UNSEEN) {
+        c->state = ABSENT;
+        break;
+      }
+      c->pos = 0;
+      c->lineno = 0;
+      continue;
+    }
+    if (parseline(r, c, line, &who, delay) && who == AorB) {
+      c->state = FOUND;
+      return (*delay < 0.0) ? REPLAY_LOST : REPLAY_DELIVERED;
+    }
+  }
+  return REPLAY_NONE;
+}
+
+void replay_close(struct replay *r)
+{
+  int i;
+
+  for (i = A; i <= B; i++)
+    if (r->cur[i].map != NULL)
+      munmap((void *)r->cur[i].map, r->cur[i].len);
+  close(r->fd);
+  free(r);
+}
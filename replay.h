@@ -0,0 +1,27 @@
+/* replay of a recorded loss and delay trace in place of the random
+   channel.  The trace is a text file with one line per packet:
+     A 12.5      the next packet A sends arrives 12.5 time units later
+     B lost      the next packet B sends is lost
+   A delay is a finite number, not negative.
+   "-" may stand for "lost", and blank lines and lines starting with '#'
+   are skipped.  Each direction reads its own lines in order and starts
+   over at the end of the file.  A direction without lines in the trace
+   keeps the random channel.  The channel still never reorders packets,
+   so a packet arrives no earlier than the one sent before it, and with
+   the link model the delay takes the place of the propagation delay.
+   The file is memory-mapped a window at a time, so traces larger than
+   memory stream through. */
+struct replay;
+
+#define REPLAY_NONE      0   /* no trace for this direction */
+#define REPLAY_LOST      1
+#define REPLAY_DELIVERED 2
+
+/* open a trace, exiting with a message if it cannot be read */
+extern struct replay *replay_open(const char *path);
+
+/* what happens to the next packet sent by A or B (int), with its delay
+   if it is delivered.  Exits with a message at a malformed line */
+extern int replay_next(struct replay *, int, double *delay);
+
+extern void replay_close(struct replay *);
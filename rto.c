@@ -0,0 +1,77 @@
+#include "rto.h"
+
+/* ******************************************************************
+   Retransmission timeout estimation (RFC 6298 without a clock
+   granularity term, the simulation clock is exact).
+**********************************************************************/
+
+#define ALPHA 0.125        /* gain of SRTT */
+#define BETA  0.25         /* gain of RTTVAR */
+#define K     4.0          /* weight of RTTVAR in the timeout */
+#define MINRTO 1.0         /* smallest timeout */
+#define MAXRTO 6000.0      /* largest timeout, the 60 seconds of RFC 6298
+                              for a round trip of about 10 */
+#define MAXBACKOFF 8.0     /* largest backed off timeout, as a multiple of
+                              the one from the samples */
+
+static double rto_clamp(double timeout)
+{
+  if (timeout < MINRTO)
+    return MINRTO;
+  if (timeout > MAXRTO)
+    return MAXRTO;
+  return timeout;
+}
+
+/* timeout doubled, but no more than MAXBACKOFF times the unbacked one */
+static double rto_double(const struct rto *r, double timeout)
+{
+  timeout *= 2;
+  if (timeout > MAXBACKOFF * r->base)
+    timeout = MAXBACKOFF * r->base;
+  return rto_clamp(timeout);
+}
+
+void rto_init(struct rto *r, int adaptive, double initial)
+{
+  r->adaptive = adaptive;
+  r->initial = initial;
+  r->srtt = 0.0;
+  r->rttvar = 0.0;
+  r->nsamples = 0;
+  r->base = initial;
+  r->timeout = initial;
+}
+
+void rto_sample(struct rto *r, double rtt)
+{
+  double err;
+
+  if (!r->adaptive)
+    return;
+  if (r->nsamples++ == 0) {
+    r->srtt = rtt;
+    r->rttvar = rtt / 2;
+  }
+  else {
+    err = r->srtt - rtt;
+    r->rttvar = (1 - BETA) * r->rttvar + BETA * (err < 0 ? -err : err);
+    r->srtt = (1 - ALPHA) * r->srtt + ALPHA * rtt;
+  }
+  r->base = rto_clamp(r->srtt + K * r->rttvar);
+  r->timeout = r->base;
+}
+
+void rto_backoff(struct rto *r)
+{
+  if (!r->adaptive)
+    return;
+  r->timeout = rto_double(r, r->timeout);
+}
+
+double rto_backedoff(const struct rto *r, int n)
+{
+  if (!r->adaptive && n > 0)
+    return 2 * r->timeout;
+  return r->timeout;
+}
@@ -0,0 +1,31 @@
+/* retransmission timeout estimation shared by the protocols.  A fixed
+   estimator always gives the initial timeout.  An adaptive one follows
+   Jacobson/Karels: it smooths round trip samples into SRTT and RTTVAR,
+   sets the timeout to SRTT + 4*RTTVAR and doubles it on every timeout,
+   up to eight times that.
+   By Karn's rule the sender must only sample packets that were never
+   resent, and the doubled timeout stays until such a sample arrives. */
+struct rto {
+  int adaptive;           /* 0 for a fixed timeout */
+  double initial;         /* timeout before the first sample */
+  double srtt;            /* smoothed round trip time */
+  double rttvar;          /* round trip time variation */
+  int nsamples;           /* samples taken so far */
+  double base;            /* timeout from the samples, before backing off */
+  double timeout;         /* timeout to use now */
+};
+
+extern void rto_init(struct rto *, int adaptive, double initial);
+
+/* a round trip time measured on a packet that was sent only once */
+extern void rto_sample(struct rto *, double rtt);
+
+/* the timer went off */
+extern void rto_backoff(struct rto *);
+
+/* the timeout for a packet that has timed out n times in a row, for
+   senders that time every packet on its own.  An adaptive one is the
+   sender's timeout, which rto_backoff already doubles.  A fixed one is
+   doubled once for a packet that was resent, as the first copy may
+   still be queued in the channel */
+extern double rto_backedoff(const struct rto *, int n);
@@ -0,0 +1,528 @@
+#define _POSIX_C_SOURCE 200112L
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "emulator.h"
+#include "runner.h"
+
+/* ******************************************************************
+   Monte Carlo replication runner.  Each replication is an independent
+   struct sim with its own seed; worker threads take the next replication
+   number from a shared counter until all have run.  Results are kept per
+   replication and summarised in replication order, so the report does
+   not depend on the number of threads or on their scheduling.
+
+   The sweep runner expands a grid of parameter values into cells and
+   runs one simulation per cell.  Cells can differ in running time by
+   orders of magnitude (high loss means many more events), so instead of
+   a shared counter each worker owns a deque of cells: it takes work from
+   the bottom of its own deque and, once that is empty, steals from the
+   top of another worker's.  Results are written in cell order.
+**********************************************************************/
+
+/* termination statistics collected from every replication */
+#define NSTATS 24
+
+static const char *statnames[NSTATS] = {
+  "simulation time",
+  "messages sent from layer 5",
+  "messages dropped due to full window",
+  "ACKs received at A",
+  "valid new ACKs received at A",
+  "packet resends by A",
+  "correct packets received at B",
+  "messages delivered to application",
+  "packets sent into layer 3",
+  "packets lost by the channel",
+  "packets corrupted by the channel",
+  "final smoothed RTT",
+  "final retransmission timeout",
+  "fast retransmits by A",
+  "final congestion window",
+  "congestion window cuts",
+  "packets dropped by full link queues",
+  "mean packets found in the link",
+  "packets dropped by queue management",
+  "median queue sojourn time",
+  "99th percentile queue sojourn time",
+  "mean loss burst, good or bad state",
+  "packets reordered by the channel",
+  "packets duplicated by the channel"
+};
+
+/* the same statistics as CSV column names */
+static const char *statkeys[NSTATS] = {
+  "time", "nsim", "window_full", "acks_received", "new_acks",
+  "packets_resent", "packets_received", "messages_delivered",
+  "ntolayer3", "nlost", "ncorrupt", "srtt", "rto",
+  "fast_retransmits", "cwnd", "cwnd_cuts", "queue_drops", "queue_mean",
+  "aqm_drops", "sojourn_p50", "sojourn_p99", "loss_burst",
+  "nreordered", "nduplicated"
+};
+
+static void getstats(struct sim *s, double *v)
+{
+  v[0] = s->time;
+  v[1] = s->nsim;
+  v[2] = s->window_full;
+  v[3] = s->total_ACKs_received;
+  v[4] = s->new_ACKs;
+  v[5] = s->packets_resent;
+  v[6] = s->packets_received;
+  v[7] = s->messages_delivered;
+  v[8] = s->ntolayer3;
+  v[9] = s->nlost;
+  v[10] = s->ncorrupt;
+  v[11] = s->srtt;
+  v[12] = s->rto;
+  v[13] = s->fast_retransmits;
+  v[14] = s->cwnd;
+  v[15] = s->cwnd_cuts;
+  v[16] = s->nqueuedrop;
+  v[17] = s->queuemean;
+  v[18] = s->naqmdrop;
+  v[19] = s->sojourn50;
+  v[20] = s->sojourn99;
+  v[21] = s->lossburst;
+  v[22] = s->nreordered;
+  v[23] = s->nduplicated;
+}
+
+/* two-sided 95% quantiles of Student's t for 1..30 degrees of freedom */
+static const double t975[30] = {
+  12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+  2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+  2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+static double tquantile(int df)
+{
+  if (df <= 30)
+    return t975[df - 1];
+  if (df <= 60)
+    return 2.000;
+  if (df <= 120)
+    return 1.980;
+  return 1.960;
+}
+
+struct replications {
+  const struct simconfig *cfg;
+  int nreps;
+  int next;                   /* next replication to run */
+  pthread_mutex_t lock;       /* protects next */
+  double (*results)[NSTATS];  /* statistics of each replication */
+};
+
+static void *replication_worker(void *arg)
+{
+  struct replications *r = arg;
+  struct simconfig cfg;
+  struct sim *s;
+  int rep;
+
+  for (;;) {
+    pthread_mutex_lock(&r->lock);
+    rep = r->next++;
+    pthread_mutex_unlock(&r->lock);
+    if (rep >= r->nreps)
+      return NULL;
+
+    cfg = *r->cfg;
+    cfg.seed = r->cfg->seed + rep;
+    s = sim_create(&cfg);
+    sim_run(s);
+    getstats(s, r->results[rep]);
+    sim_destroy(s);
+  }
+}
+
+/* number of worker threads to use when none was asked for */
+static int default_threads(void)
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return (n > 0) ? (int)n : 1;
+}
+
+void run_replications(const struct simconfig *cfg, int nreps, int nthreads)
+{
+  struct replications r;
+  pthread_t *threads;
+  double mean, var, d, half;
+  int i, k;
+
+  if (nthreads <= 0)
+    nthreads = default_threads();
+  if (nthreads > nreps)
+    nthreads = nreps;
+
+  r.cfg = cfg;
+  r.nreps = nreps;
+  r.next = 0;
+  r.results = malloc(nreps * sizeof(*r.results));
+  threads = malloc(nthreads * sizeof(pthread_t));
+  if (r.results == NULL || threads == NULL) {
+    printf("memory allocation for replications failed.");
+    exit(EXIT_FAILURE);
+  }
+  pthread_mutex_init(&r.lock, NULL);
+
+  for (i = 0; i < nthreads; i++)
+    if (pthread_create(&threads[i], NULL, replication_worker, &r) != 0) {
+      printf("unable to start replication thread.\n");
+      exit(EXIT_FAILURE);
+    }
+  for (i = 0; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+  pthread_mutex_destroy(&r.lock);
+
+  printf(" %d replications on %d threads, seeds %lu to %lu\n",
+         nreps, nthreads, cfg->seed, cfg->seed + nreps - 1);
+  printf("%-40s %14s %14s %31s\n", "statistic", "mean", "stddev", "95% confidence interval");
+  for (k = 0; k < NSTATS; k++) {
+    mean = 0.0;
+    for (i = 0; i < nreps; i++)
+      mean += r.results[i][k];
+    mean /= nreps;
+    var = 0.0;
+    for (i = 0; i < nreps; i++) {
+      d = r.results[i][k] - mean;
+      var += d * d;
+    }
+    var = (nreps > 1) ? var / (nreps - 1) : 0.0;
+    half = (nreps > 1) ? tquantile(nreps - 1) * sqrt(var / nreps) : 0.0;
+    printf("%-40s %14.3f %14.3f [%14.3f, %14.3f]\n",
+           statnames[k], mean, sqrt(var), mean - half, mean + half);
+  }
+
+  free(threads);
+  free(r.results);
+}
+
+/* ************************ SWEEPS ******************************** */
+
+#define MAXAXES 16   /* most parameters one sweep can vary */
+
+struct axis {
+  const char *key;    /* parameter swept */
+  int nvalues;
+  char **values;      /* its values, as given in the specification */
+};
+
+struct sweep {
+  int naxes;
+  struct axis axes[MAXAXES];
+  int ncells;         /* product of the number of values of every axis */
+};
+
+static void addvalue(struct axis *ax, const char *value)
+{
+  if ((ax->nvalues & (ax->nvalues - 1)) == 0) {   /* 0, 1, 2, 4, ... */
+    ax->values = realloc(ax->values, (ax->nvalues ? 2 * ax->nvalues : 1) * sizeof(char *));
+    if (ax->values == NULL) {
+      printf("memory allocation for sweep failed.");
+      exit(EXIT_FAILURE);
+    }
+  }
+  if ((ax->values[ax->nvalues++] = emu_savestring(value)) == NULL) {
+    printf("memory allocation for sweep failed.");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* add the values of "first:last:step" to ax, returns 0 if value is not
+   such a range */
+static int addrange(struct axis *ax, const char *value)
+{
+  double first, last, step;
+  char buf[32], c;
+  int i, n;
+
+  if (sscanf(value, "%lf:%lf:%lf%c", &first, &last, &step, &c) != 3
+      || step <= 0.0 || last < first)
+    return 0;
+  n = (int)floor((last - first) / step + 1e-9) + 1;
+  for (i = 0; i < n; i++) {
+    sprintf(buf, "%.10g", first + i * step);
+    addvalue(ax, buf);
+  }
+  return 1;
+}
+
+/* the specification has one "key = values" line per swept parameter,
+   where values is a list of values and first:last:step ranges separated
+   by commas or blanks, and '#' starts a comment.  For example
+     loss    = 0:0.4:0.1
+     lambda  = 10, 20, 50
+     window  = 2 4 6
+   sweeps 5 x 3 x 3 = 45 cells */
+struct sweep *sweep_load(const char *path)
+{
+  struct sweep *sw;
+  struct axis *ax;
+  struct simconfig blank, scratch;
+  char line[1024];
+  char *key, *value, *cp;
+  int i, lineno = 0;
+  FILE *fp;
+
+  fp = fopen(path, "r");
+  if (fp == NULL) {
+    printf("unable to open sweep file %s\n", path);
+    exit(EXIT_FAILURE);
+  }
+  sw = calloc(1, sizeof(struct sweep));
+  if (sw == NULL) {
+    printf("memory allocation for sweep failed.");
+    exit(EXIT_FAILURE);
+  }
+  sw->ncells = 1;
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    lineno++;
+    if ((cp = strchr(line, '#')) != NULL)
+      *cp = '\0';
+    key = emu_trim(line);
+    if (*key == '\0')
+      continue;
+    if ((cp = strchr(key, '=')) == NULL) {
+      printf("%s:%d: expected key = values\n", path, lineno);
+      exit(EXIT_FAILURE);
+    }
+    *cp = '\0';
+    key = emu_trim(key);
+    value = cp + 1;
+    /* cells run on several threads and would write to the same file */
+    if (strcmp(key, "tracefile") == 0 || strcmp(key, "cwndfile") == 0) {
+      printf("%s:%d: a trace can only be written for a single run, %s cannot be swept\n", path, lineno, key);
+      exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < sw->naxes; i++)
+      if (strcmp(sw->axes[i].key, key) == 0) {
+        printf("%s:%d: %s is swept twice\n", path, lineno, key);
+        exit(EXIT_FAILURE);
+      }
+    if (sw->naxes == MAXAXES) {
+      printf("%s:%d: at most %d parameters can be swept\n", path, lineno, MAXAXES);
+      exit(EXIT_FAILURE);
+    }
+    ax = &sw->axes[sw->naxes++];
+    if ((ax->key = emu_savestring(key)) == NULL) {
+      printf("memory allocation for sweep failed.");
+      exit(EXIT_FAILURE);
+    }
+    for (value = strtok(value, ", \t\r\n"); value != NULL; value = strtok(NULL, ", \t\r\n"))
+      if (!addrange(ax, value))
+        addvalue(ax, value);
+    if (ax->nvalues == 0) {
+      printf("%s:%d: no values for %s\n", path, lineno, key);
+      exit(EXIT_FAILURE);
+    }
+    memset(&blank, 0, sizeof(blank));
+    for (i = 0; i < ax->nvalues; i++) {
+      scratch = blank;
+      if (!simconfig_set(&scratch, ax->key, ax->values[i])) {
+        printf("%s:%d: cannot sweep %s over %s\n", path, lineno, ax->key, ax->values[i]);
+        exit(EXIT_FAILURE);
+      }
+      simconfig_release(&scratch, &blank);
+    }
+    if (sw->ncells > INT_MAX / ax->nvalues) {
+      printf("%s:%d: too many cells\n", path, lineno);
+      exit(EXIT_FAILURE);
+    }
+    sw->ncells *= ax->nvalues;
+  }
+  fclose(fp);
+  return sw;
+}
+
+void sweep_free(struct sweep *sw)
+{
+  int a, i;
+
+  for (a = 0; a < sw->naxes; a++) {
+    for (i = 0; i < sw->axes[a].nvalues; i++)
+      free(sw->axes[a].values[i]);
+    free(sw->axes[a].values);
+    free((char *)sw->axes[a].key);
+  }
+  free(sw);
+}
+
+/* index into the values of axis a of the given cell.  The last axis
+   varies fastest */
+static int cellvalue(const struct sweep *sw, int cell, int a)
+{
+  int i;
+
+  for (i = sw->naxes - 1; i > a; i--)
+    cell /= sw->axes[i].nvalues;
+  return cell % sw->axes[a].nvalues;
+}
+
+/* cells still to run by one worker, order[top..bottom-1] */
+struct deque {
+  int top;                  /* next cell to be stolen */
+  int bottom;               /* one past the next cell its owner runs */
+  pthread_mutex_t lock;     /* protects top and bottom */
+};
+
+struct sweeprun {
+  struct simconfig *cfgs;     /* configuration of each cell */
+  int *order;                 /* cells, split into the workers' deques */
+  struct deque *deques;
+  int nthreads;
+  int stolen;                 /* cells run by a worker other than their owner */
+  pthread_mutex_t lock;       /* protects stolen */
+  double (*results)[NSTATS];  /* statistics of each cell */
+};
+
+struct sweepworker {
+  struct sweeprun *run;
+  int self;                   /* index of the worker's own deque */
+};
+
+/* take the cell at the bottom of worker w's deque, -1 if it is empty */
+static int popcell(struct sweeprun *run, int w)
+{
+  struct deque *dq = &run->deques[w];
+  int cell = -1;
+
+  pthread_mutex_lock(&dq->lock);
+  if (dq->bottom > dq->top)
+    cell = run->order[--dq->bottom];
+  pthread_mutex_unlock(&dq->lock);
+  return cell;
+}
+
+/* take the cell at the top of another worker's deque, -1 if every deque
+   is empty.  No cells are added once the sweep starts, so then the
+   sweep is done */
+static int stealcell(struct sweeprun *run, int self)
+{
+  struct deque *dq;
+  int i, cell = -1;
+
+  for (i = 1; i < run->nthreads && cell < 0; i++) {
+    dq = &run->deques[(self + i) % run->nthreads];
+    pthread_mutex_lock(&dq->lock);
+    if (dq->bottom > dq->top)
+      cell = run->order[dq->top++];
+    pthread_mutex_unlock(&dq->lock);
+  }
+  if (cell >= 0) {
+    pthread_mutex_lock(&run->lock);
+    run->stolen++;
+    pthread_mutex_unlock(&run->lock);
+  }
+  return cell;
+}
+
+static void *sweep_worker(void *arg)
+{
+  struct sweepworker *w = arg;
+  struct sweeprun *run = w->run;
+  struct sim *s;
+  int cell;
+
+  for (;;) {
+    if ((cell = popcell(run, w->self)) < 0 && (cell = stealcell(run, w->self)) < 0)
+      return NULL;
+    s = sim_create(&run->cfgs[cell]);
+    sim_run(s);
+    getstats(s, run->results[cell]);
+    sim_destroy(s);
+  }
+}
+
+void run_sweep(const struct sweep *sw, const struct simconfig *cfg, const char *csvpath, int nthreads)
+{
+  struct sweeprun run;
+  struct sweepworker *workers;
+  pthread_t *threads;
+  FILE *csv;
+  int i, a, k;
+
+  if (nthreads <= 0)
+    nthreads = default_threads();
+  if (nthreads > sw->ncells)
+    nthreads = sw->ncells;
+  if ((csv = fopen(csvpath, "w")) == NULL) {
+    printf("unable to open CSV file %s\n", csvpath);
+    exit(EXIT_FAILURE);
+  }
+
+  run.cfgs = malloc(sw->ncells * sizeof(struct simconfig));
+  run.order = malloc(sw->ncells * sizeof(int));
+  run.results = malloc(sw->ncells * sizeof(*run.results));
+  run.deques = malloc(nthreads * sizeof(struct deque));
+  workers = malloc(nthreads * sizeof(struct sweepworker));
+  threads = malloc(nthreads * sizeof(pthread_t));
+  if (run.cfgs == NULL || run.order == NULL || run.results == NULL
+      || run.deques == NULL || workers == NULL || threads == NULL) {
+    printf("memory allocation for sweep failed.");
+    exit(EXIT_FAILURE);
+  }
+
+  /* the configurations are made up front, setting parameters is not
+     thread safe */
+  for (i = 0; i < sw->ncells; i++) {
+    run.cfgs[i] = *cfg;
+    for (a = 0; a < sw->naxes; a++)
+      simconfig_set(&run.cfgs[i], sw->axes[a].key, sw->axes[a].values[cellvalue(sw, i, a)]);
+    run.order[i] = i;
+    if (!sim_threadsafe(&run.cfgs[i]) && nthreads > 1) {
+      printf("this sweep can only run with -j 1\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  /* each worker starts with a contiguous block of cells */
+  run.nthreads = nthreads;
+  run.stolen = 0;
+  pthread_mutex_init(&run.lock, NULL);
+  for (i = 0; i < nthreads; i++) {
+    run.deques[i].top = (int)((long)sw->ncells * i / nthreads);
+    run.deques[i].bottom = (int)((long)sw->ncells * (i + 1) / nthreads);
+    pthread_mutex_init(&run.deques[i].lock, NULL);
+    workers[i].run = &run;
+    workers[i].self = i;
+  }
+  for (i = 0; i < nthreads; i++)
+    if (pthread_create(&threads[i], NULL, sweep_worker, &workers[i]) != 0) {
+      printf("unable to start sweep thread.\n");
+      exit(EXIT_FAILURE);
+    }
+  for (i = 0; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+  for (i = 0; i < nthreads; i++)
+    pthread_mutex_destroy(&run.deques[i].lock);
+  pthread_mutex_destroy(&run.lock);
+
+  for (a = 0; a < sw->naxes; a++)
+    fprintf(csv, "%s,", sw->axes[a].key);
+  for (k = 0; k < NSTATS; k++)
+    fprintf(csv, "%s%c", statkeys[k], (k == NSTATS - 1) ? '\n' : ',');
+  for (i = 0; i < sw->ncells; i++) {
+    for (a = 0; a < sw->naxes; a++)
+      fprintf(csv, "%s,", sw->axes[a].values[cellvalue(sw, i, a)]);
+    for (k = 0; k < NSTATS; k++)
+      fprintf(csv, "%.10g%c", run.results[i][k], (k == NSTATS - 1) ? '\n' : ',');
+  }
+  fclose(csv);
+  printf(" %d cells on %d threads, %d stolen, results in %s\n",
+         sw->ncells, nthreads, run.stolen, csvpath);
+
+  for (i = 0; i < sw->ncells; i++)
+    simconfig_release(&run.cfgs[i], cfg);
+  free(threads);
+  free(workers);
+  free(run.deques);
+  free(run.results);
+  free(run.order);
+  free(run.cfgs);
+}
@@ -0,0 +1,22 @@
+/* run nreps independent replications of the simulation described by cfg
+   on nthreads worker threads, replication i using seed cfg->seed + i, and
+   print the mean, standard deviation and 95% confidence interval of each
+   termination statistic.  nthreads <= 0 uses one thread per processor */
+extern void run_replications(const struct simconfig *cfg, int nreps, int nthreads);
+
+/* a parameter grid read from a sweep specification, one "key = values"
+   line per swept parameter */
+struct sweep;
+
+/* read a sweep specification, exiting with a message if it is invalid.
+   The swept parameters do not count as given, the base configuration
+   still prompts for them */
+extern struct sweep *sweep_load(const char *path);
+
+/* free a sweep read by sweep_load */
+extern void sweep_free(struct sweep *);
+
+/* run one simulation per cell of the grid, each starting from cfg with
+   the cell's values applied, on nthreads worker threads, and write one
+   CSV row per cell to csvpath */
+extern void run_sweep(const struct sweep *, const struct simconfig *cfg, const char *csvpath, int nthreads);
@@ -1,7 +1,10 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <limits.h>
 #include "emulator.h"
+#include "rto.h"
+#include "cc.h"
 #include "sr.h"
 
 /* ******************************************************************
@@ -14,15 +17,23 @@
    - packets can be corrupted (either the header or the data portion)
    or lost, according to user-defined probabilities
    - packets will be delivered in the order in which they were sent
-   (although some can be lost).
+   (although some can be lost), unless reordering or duplication is
+   turned on with "-e" or "-u".
 **********************************************************************/
 
 #define RTT  16.0       /* round trip time.  MUST BE SET TO 16.0 when submitting assignment */
-#define WINDOWSIZE 6    /* the maximum number of buffered unacked packet
+#define WINDOWSIZE 6    /* the default number of buffered unacked packet
                           MUST BE SET TO 6 when submitting assignment */
-#define SEQSPACE 12     /* the min sequence space for SR must be at least 2*windowsize */
+                        /* the sequence space defaults to the least SR allows, 2*windowsize */
 #define NOTINUSE (-1)   /* used to fill header fields that are not being used */
 
+/* with selective acknowledgements (-k 1) every ACK is cumulative, acknum
+   is the last packet B delivered, and the payload is a bitmap: bit i
+   (bit i%8 of payload[i/8]) is set if B holds packet acknum+1+i.  The
+   checksum covers it like any payload */
+#define SACKBITS 160
+#define SACKED(packet, i) ((i) < SACKBITS && ((packet).payload[(i) / 8] >> ((i) % 8)) & 1)
+
 /* generic procedure to compute the checksum of a packet */
 int ComputeChecksum(struct pkt packet)
 {
@@ -48,92 +59,337 @@ bool IsCorrupted(struct pkt packet)
 
 /********* Sender (A) variables and functions ************/
 
-static struct pkt buffer[WINDOWSIZE];  /* array for storing packets waiting for ACK */
-static int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
-static int windowcount;                /* the number of packets currently awaiting an ACK */
-static int A_nextseqnum;               /* the next sequence number to be used by the sender */
-static bool acked[SEQSPACE];           /* array to track if a packet has been ACKed */
+/* the window size and sequence space given at startup, if any.  Exits
+   if SR cannot tell the packets of one window from the next */
+static void getwindow(struct sim *s, int *windowsize, int *seqspace)
+{
+  int depth, least;
+
+  *windowsize = (s->cfg->windowsize > 0) ? s->cfg->windowsize : WINDOWSIZE;
+  if (*windowsize > INT_MAX / 4) {
+    printf("window size %d is too large\n", *windowsize);
+    exit(EXIT_FAILURE);
+  }
+  /* a late packet or ACK can be overtaken by the next depth packets
+     sent after it.  B ACKs whatever arrives, so a late packet can make B
+     send an ACK that is late itself: both can be depth packets behind,
+     and B's window can be a window past the packet ACKed */
+  depth = sim_reorderdepth(s->cfg);
+  least = (depth > 0) ? 3 * *windowsize + 2 * depth - 1 : 2 * *windowsize;
+  *seqspace = (s->cfg->seqspace > 0) ? s->cfg->seqspace : least;
+  if (*seqspace < least || *seqspace > INT_MAX / 2) {
+    printf("a sequence space of %d does not suit a window of %d, SR needs at least %d\n",
+           *seqspace, *windowsize, least);
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* The sender and receiver state are each a single block, as the
+   emulator frees them with free(): the struct followed by the arrays
+   its pointers refer to, largest alignment first */
+
+struct sender {
+  struct pkt *buffer;             /* array for storing packets waiting for ACK */
+  int windowfirst, windowlast;    /* array indexes of the first/last packet awaiting ACK */
+  int windowcount;                /* the number of packets currently awaiting an ACK */
+  int nextseqnum;                 /* the next sequence number to be used by the sender */
+  int windowsize;                 /* window size, and the size of the arrays by buffer slot */
+  int seqspace;                   /* number of sequence numbers */
+  struct rto rto;                 /* retransmission timeout */
+  struct cc cc;                   /* congestion window */
+  double *sendtime;               /* when each buffered packet was last sent */
+  int *resent;                    /* times the packet was resent, its ACK then gives no RTT sample */
+  bool *acked;                    /* array to track if a packet has been ACKed, by seqnum */
+
+  /* every unACKed packet has its own retransmission deadline.  The
+     deadlines are kept in a min-heap of buffer indexes, and A's one
+     emulator timer is always set for the earliest of them */
+  double *deadline;               /* deadline of the packet in each buffer slot */
+  int *heap;                      /* buffer indexes, earliest deadline first */
+  int *heappos;                   /* position in heap of each buffer slot */
+  int heapcount;
+  bool timerset;                  /* the emulator timer is running ... */
+  double timerdeadline;           /* ... and goes off at this deadline */
+};
+
+/* restore the heap order from position i towards the root and leaves */
+static void timer_fix(struct sender *a, int i)
+{
+  int slot = a->heap[i];
+  int child;
+
+  while (i > 0 && a->deadline[a->heap[(i - 1) / 2]] > a->deadline[slot]) {
+    a->heap[i] = a->heap[(i - 1) / 2];
+    a->heappos[a->heap[i]] = i;
+    i = (i - 1) / 2;
+  }
+  for (;;) {
+    child = 2 * i + 1;
+    if (child >= a->heapcount)
+      break;
+    if (child + 1 < a->heapcount && a->deadline[a->heap[child + 1]] < a->deadline[a->heap[child]])
+      child++;
+    if (a->deadline[a->heap[child]] >= a->deadline[slot])
+      break;
+    a->heap[i] = a->heap[child];
+    a->heappos[a->heap[i]] = i;
+    i = child;
+  }
+  a->heap[i] = slot;
+  a->heappos[slot] = i;
+}
+
+/* start the logical timer of the packet in buffer slot */
+static void timer_add(struct sim *s, int slot)
+{
+  struct sender *a = s->A_state;
+
+  a->deadline[slot] = s->time + rto_backedoff(&a->rto, a->resent[slot]);
+  a->heap[a->heapcount] = slot;
+  a->heappos[slot] = a->heapcount;
+  a->heapcount++;
+  timer_fix(a, a->heapcount - 1);
+}
+
+/* stop the logical timer of the packet in buffer slot */
+static void timer_remove(struct sender *a, int slot)
+{
+  int i = a->heappos[slot];
+
+  a->heapcount--;
+  if (i == a->heapcount)
+    return;
+  a->heap[i] = a->heap[a->heapcount];
+  a->heappos[a->heap[i]] = i;
+  timer_fix(a, i);
+}
+
+/* restart the logical timers of the packets sent after the last one
+   ACKed.  The ACK shows the channel is still moving, so as in RFC 6298
+   (5.3) the timer of the first of them that was started runs a full
+   timeout again from now, and the others move back with it.  The ACK
+   says nothing about packets sent before it, they keep their deadlines.
+   A fixed timeout needs this once the channel backs up past it, or
+   every packet in the window times out and is sent again.  An adaptive
+   timeout follows the round trip already, restarting it would only
+   hold back the packets that were lost */
+static void timer_restart(struct sim *s)
+{
+  struct sender *a = s->A_state;
+  double shift, elapsed;
+  int from, i, idx;
+
+  if (a->rto.adaptive)
+    return;
+  from = 0;
+  for (i = 0; i < a->windowcount; i++)
+    if (a->acked[a->buffer[(a->windowfirst + i) % a->windowsize].seqnum])
+      from = i + 1;
+
+  shift = 0.0;
+  for (i = from; i < a->windowcount; i++) {
+    idx = (a->windowfirst + i) % a->windowsize;
+    elapsed = s->time + a->rto.timeout - a->deadline[idx];
+    if (elapsed > shift)
+      shift = elapsed;
+  }
+  if (shift == 0.0)
+    return;
+  for (i = from; i < a->windowcount; i++) {
+    idx = (a->windowfirst + i) % a->windowsize;
+    a->deadline[idx] += shift;
+    timer_fix(a, a->heappos[idx]);
+  }
+}
+
+/* publish the timeout estimate in the statistics */
+static void showrto(struct sim *s, struct rto *r)
+{
+  s->srtt = r->srtt;
+  s->rto = r->timeout;
+}
+
+/* publish the congestion window in the statistics and its time series */
+static void showcc(struct sim *s, struct cc *c)
+{
+  if (!c->enabled)
+    return;
+  s->cwnd = c->cwnd;
+  s->cwnd_cuts = c->cuts;
+  recordcwnd(s, A, c->cwnd, c->ssthresh);
+}
+
+/* mark the packet in buffer slot idx as ACKed, returns false if it was already */
+static bool ackpacket(struct sim *s, int idx)
+{
+  struct sender *a = s->A_state;
+
+  if (a->acked[a->buffer[idx].seqnum])
+    return false;
+
+  /* its timer is no longer needed */
+  a->acked[a->buffer[idx].seqnum] = true;
+  timer_remove(a, idx);
+
+  /* time it, unless it was resent (Karn's rule) */
+  if (a->resent[idx] == 0) {
+    rto_sample(&a->rto, s->time - a->sendtime[idx]);
+    showrto(s, &a->rto);
+  }
+  cc_ack(&a->cc, s->time, 1, (a->resent[idx] == 0) ? s->time - a->sendtime[idx] : -1.0);
+  showcc(s, &a->cc);
+  return true;
+}
+
+/* slide window until we find an unACKed packet */
+static void slidewindow(struct sender *a)
+{
+  while (a->windowcount > 0 && a->acked[a->buffer[a->windowfirst].seqnum]) {
+    a->windowfirst = (a->windowfirst + 1) % a->windowsize;
+    a->windowcount--;
+  }
+}
+
+/* set the emulator timer for the earliest deadline, if it changed */
+static void timer_update(struct sim *s)
+{
+  struct sender *a = s->A_state;
+  double next;
+
+  if (a->heapcount == 0) {
+    if (a->timerset)
+      stoptimer(s, A);
+    a->timerset = false;
+    return;
+  }
+  next = a->deadline[a->heap[0]];
+  if (a->timerset && a->timerdeadline == next)
+    return;
+  if (a->timerset)
+    stoptimer(s, A);
+  starttimer(s, A, (next > s->time) ? next - s->time : 0.0);
+  a->timerset = true;
+  a->timerdeadline = next;
+}
 
 /* called from layer 5 (application layer), passed the message to be sent to other side */
-void A_output(struct msg message)
+void A_output(struct sim *s, struct msg message)
 {
+  struct sender *a = s->A_state;
   struct pkt sendpkt;
   int i;
 
   /* if not blocked waiting on ACK */
-  if ( windowcount < WINDOWSIZE) {
-    if (TRACE > 1)
+  if ( a->windowcount < a->windowsize && cc_cansend(&a->cc, a->windowcount, s->time)) {
+    if (TRACING(2))
       printf("----A: New message arrives, send window is not full, send new messge to layer3!\n");
 
     /* create packet */
-    sendpkt.seqnum = A_nextseqnum;
+    sendpkt.seqnum = a->nextseqnum;
     sendpkt.acknum = NOTINUSE;
     for ( i=0; i<20 ; i++ )
       sendpkt.payload[i] = message.data[i];
     sendpkt.checksum = ComputeChecksum(sendpkt);
 
     /* put packet in window buffer */
-    windowlast = (windowlast + 1) % WINDOWSIZE;
-    buffer[windowlast] = sendpkt;
-    windowcount++;
-    acked[sendpkt.seqnum] = false;  /* mark as not ACKed */
+    a->windowlast = (a->windowlast + 1) % a->windowsize;
+    a->buffer[a->windowlast] = sendpkt;
+    a->sendtime[a->windowlast] = s->time;
+    a->resent[a->windowlast] = 0;
+    a->windowcount++;
+    a->acked[sendpkt.seqnum] = false;  /* mark as not ACKed */
 
     /* send out packet */
-    if (TRACE > 0)
+    if (TRACING(1))
       printf("Sending packet %d to layer 3\n", sendpkt.seqnum);
-    tolayer3 (A, sendpkt);
+    tolayer3(s, A, sendpkt);
+    cc_sent(&a->cc, s->time);
 
-    /* start timer for this packet if it's the first one */
-    if (windowcount == 1)
-      starttimer(A, RTT);
+    /* start the timer for this packet */
+    timer_add(s, a->windowlast);
+    timer_update(s);
 
     /* get next sequence number, wrap back to 0 */
-    A_nextseqnum = (A_nextseqnum + 1) % SEQSPACE;
+    a->nextseqnum = (a->nextseqnum + 1) % a->seqspace;
   }
   /* if blocked, window is full */
   else {
-    if (TRACE > 0)
+    if (TRACING(1))
       printf("----A: New message arrives, send window is full\n");
-    window_full++;
+    s->window_full++;
   }
 }
 
 
+/* ACK every packet that a selective acknowledgement covers */
+static void readsack(struct sim *s, struct pkt packet)
+{
+  struct sender *a = s->A_state;
+  int cumulative, i, idx;
+  bool isnew = false;
+
+  /* the number of packets in the window the cumulative ACK covers.  An
+     ACK from before the window starts is too old for its bitmap to be read */
+  cumulative = (packet.acknum - a->buffer[a->windowfirst].seqnum + a->seqspace) % a->seqspace + 1;
+  if (cumulative == a->seqspace)
+    cumulative = 0;
+  else if (cumulative > a->windowcount)
+    return;
+
+  for (i = 0; i < a->windowcount; i++) {
+    idx = (a->windowfirst + i) % a->windowsize;
+    if (i < cumulative || SACKED(packet, i - cumulative))
+      isnew |= ackpacket(s, idx);
+  }
+
+  if (isnew) {
+    if (TRACING(1))
+      printf("----A: ACK %d is not a duplicate\n", packet.acknum);
+    s->new_ACKs++;
+    slidewindow(a);
+    timer_restart(s);
+    timer_update(s);
+  }
+  else if (TRACING(1))
+    printf ("----A: duplicate ACK received, do nothing!\n");
+}
+
 /* called from layer 3, when a packet arrives for layer 4 */
-void A_input(struct pkt packet)
+void A_input(struct sim *s, struct pkt packet)
 {
+  struct sender *a = s->A_state;
   int i;
   int idx;
   bool can_slide = false;
 
   /* if received ACK is not corrupted */
   if (!IsCorrupted(packet)) {
-    if (TRACE > 0)
+    if (TRACING(1))
       printf("----A: uncorrupted ACK %d is received\n", packet.acknum);
-    total_ACKs_received++;
+    s->total_ACKs_received++;
 
     /* check if new ACK or duplicate */
-    if (windowcount != 0) {
-      int seqfirst = buffer[windowfirst].seqnum;
-      int seqlast = buffer[windowlast].seqnum;
+    if (a->windowcount != 0 && s->cfg->sack)
+      readsack(s, packet);
+    else if (a->windowcount != 0) {
+      int seqfirst = a->buffer[a->windowfirst].seqnum;
+      int seqlast = a->buffer[a->windowlast].seqnum;
       
       /* check if ACK is within window */
       if (((seqfirst <= seqlast) && (packet.acknum >= seqfirst && packet.acknum <= seqlast)) ||
           ((seqfirst > seqlast) && (packet.acknum >= seqfirst || packet.acknum <= seqlast))) {
         
         /* find the packet in the window */
-        for (i = 0; i < windowcount; i++) {
-          idx = (windowfirst + i) % WINDOWSIZE;
-          if (buffer[idx].seqnum == packet.acknum && !acked[packet.acknum]) {
-            /* mark as ACKed */
-            acked[packet.acknum] = true;
-            
-            if (TRACE > 0)
+        for (i = 0; i < a->windowcount; i++) {
+          idx = (a->windowfirst + i) % a->windowsize;
+          if (a->buffer[idx].seqnum == packet.acknum && ackpacket(s, idx)) {
+            if (TRACING(1))
               printf("----A: ACK %d is not a duplicate\n", packet.acknum);
-            new_ACKs++;
+            s->new_ACKs++;
+            timer_restart(s);
             
             /* check if we can slide window */
-            if (idx == windowfirst) {
+            if (idx == a->windowfirst) {
               can_slide = true;
             }
             break;
@@ -141,134 +397,209 @@ void A_input(struct pkt packet)
         }
         
         /* if we can slide window */
-        if (can_slide) {
-          /* slide window until we find an unACKed packet */
-          while (windowcount > 0 && acked[buffer[windowfirst].seqnum]) {
-            windowfirst = (windowfirst + 1) % WINDOWSIZE;
-            windowcount--;
-          }
-          
-          /* restart timer if there are still packets in window */
-          stoptimer(A);
-          if (windowcount > 0) {
-            starttimer(A, RTT);
-          }
-        }
+        if (can_slide)
+          slidewindow(a);
+        timer_update(s);
       }
     }
     else
-      if (TRACE > 0)
+      if (TRACING(1))
         printf ("----A: duplicate ACK received, do nothing!\n");
   }
   else
-    if (TRACE > 0)
+    if (TRACING(1))
       printf ("----A: corrupted ACK is received, do nothing!\n");
 }
 
 /* called when A's timer goes off */
-void A_timerinterrupt(void)
+void A_timerinterrupt(struct sim *s)
 {
-  if (TRACE > 0)
+  struct sender *a = s->A_state;
+  int idx;
+
+  if (TRACING(1))
     printf("----A: time out,resend packets!\n");
+  a->timerset = false;
 
-  /* 重传窗口中的第一个未确认数据包 */
-  int i;
-  for (i = 0; i < windowcount; i++) {
-    int idx = (windowfirst + i) % WINDOWSIZE;
-    if (!acked[buffer[idx].seqnum]) {
-      if (TRACE > 0)
-        printf ("---A: resending packet %d\n", buffer[idx].seqnum);
-      
-      tolayer3(A, buffer[idx]);
-      packets_resent++;
-      break; /* 只重传一个数据包后退出 */
+  /* resend the packet whose deadline this was, and any other that is due */
+  do {
+    idx = a->heap[0];
+    timer_remove(a, idx);
+
+    /* back off the sender's timeout once per loss episode, when the
+       packet B waits for first times out.  New packets start from it
+       too, or none of them would outlast a round trip that grew past it
+       and give a sample.  Backing off for every packet due would
+       compound the doubling across the window */
+    if (idx == a->windowfirst && a->resent[idx] == 0) {
+      rto_backoff(&a->rto);
+      showrto(s, &a->rto);
     }
-  }
-  
-  /* 重启计时器 */
-  if (windowcount > 0) {
-    starttimer(A, RTT);
-  }
+
+    if (TRACING(1))
+      printf ("---A: resending packet %d\n", a->buffer[idx].seqnum);
+    cc_timeout(&a->cc, s->time, a->sendtime[idx]);
+    showcc(s, &a->cc);
+    tolayer3(s, A, a->buffer[idx]);
+    a->sendtime[idx] = s->time;
+    a->resent[idx]++;   /* no longer timed, by Karn's rule */
+    s->packets_resent++;
+    timer_add(s, idx);
+  } while (a->deadline[a->heap[0]] <= s->time);
+  timer_update(s);
 }
 
 /* initialization function */
-void A_init(void)
+void A_init(struct sim *s)
 {
+  struct sender *a;
+  int windowsize, seqspace;
   int i;
-  
+
+  getwindow(s, &windowsize, &seqspace);
+  a = malloc(sizeof(struct sender)
+             + windowsize * (2 * sizeof(double) + sizeof(struct pkt) + 3 * sizeof(int))
+             + seqspace * sizeof(bool));
+  if (a == NULL) {
+    printf("memory allocation for sender failed.");
+    exit(EXIT_FAILURE);
+  }
+  s->A_state = a;
+  a->windowsize = windowsize;
+  a->seqspace = seqspace;
+  a->sendtime = (double *)(a + 1);
+  a->deadline = a->sendtime + windowsize;
+  a->buffer = (struct pkt *)(a->deadline + windowsize);
+  a->resent = (int *)(a->buffer + windowsize);
+  a->heap = a->resent + windowsize;
+  a->heappos = a->heap + windowsize;
+  a->acked = (bool *)(a->heappos + windowsize);
+
   /* initialise A's window, buffer and sequence number */
-  A_nextseqnum = 0;  /* A starts with seq num 0 */
-  windowfirst = 0;
-  windowlast = -1;   /* windowlast is where the last packet sent is stored */
-  windowcount = 0;
+  a->nextseqnum = 0;  /* A starts with seq num 0 */
+  a->windowfirst = 0;
+  a->windowlast = -1;   /* windowlast is where the last packet sent is stored */
+  a->windowcount = 0;
+  a->heapcount = 0;
+  a->timerset = false;
+
+  /* use the timeout given at startup, if any */
+  rto_init(&a->rto, s->cfg->rtomode, (s->cfg->rtt > 0.0) ? s->cfg->rtt : RTT);
+  showrto(s, &a->rto);
+  cc_init(&a->cc, s->cfg->congestion, windowsize);
+  showcc(s, &a->cc);
   
   /* initialize acked array */
-  for (i = 0; i < SEQSPACE; i++)
-    acked[i] = false;
+  for (i = 0; i < a->seqspace; i++)
+    a->acked[i] = false;
 }
 
 /********* Receiver (B) variables and procedures ************/
 
-static int B_nextseqnum;   /* the sequence number for the next packets sent by B */
+struct receiver {
+  int expectedseqnum;         /* the first sequence number of the receive window */
+  int windowsize;             /* receive window size, the same as the sender's */
+  int seqspace;               /* number of sequence numbers, and the size of the arrays */
+  struct pkt *buffer;         /* packets received ahead of expectedseqnum, by sequence number */
+  bool *received;             /* buffer[seqnum] holds a packet not yet delivered */
+};
 
-/* called from layer 3, when a packet arrives for layer 4 at B */
-void B_input(struct pkt packet)
+/* send an ACK for acknum, with the bitmap of the packets held if
+   selective acknowledgements are used */
+static void sendack(struct sim *s, int acknum)
 {
+  struct receiver *b = s->B_state;
   struct pkt ackpkt;
   int i;
+
+  ackpkt.seqnum = NOTINUSE;
+  ackpkt.acknum = acknum;
+  ackpkt.checksum = 0;
+  for (i = 0; i < 20; i++)
+    ackpkt.payload[i] = 0;
+  if (s->cfg->sack)
+    for (i = 0; i < b->windowsize && i < SACKBITS; i++)
+      if (b->received[(acknum + 1 + i) % b->seqspace])
+        ackpkt.payload[i / 8] |= 1 << (i % 8);
+  ackpkt.checksum = ComputeChecksum(ackpkt);
+
+  tolayer3(s, B, ackpkt);
+}
+
+/* called from layer 3, when a packet arrives for layer 4 at B */
+void B_input(struct sim *s, struct pkt packet)
+{
+  struct receiver *b = s->B_state;
   
   /* if packet is not corrupted */
   if (!IsCorrupted(packet)) {
-    if (TRACE > 0)
+    if (TRACING(1))
       printf("----B: packet %d is correctly received, send ACK!\n", packet.seqnum);
     
-    packets_received++;
+    s->packets_received++;
     
-    /* create and send ACK packet */
-    ackpkt.seqnum = NOTINUSE;
-    ackpkt.acknum = packet.seqnum;
-    ackpkt.checksum = 0;
-    for (i = 0; i < 20; i++)
-      ackpkt.payload[i] = 0;
-    ackpkt.checksum = ComputeChecksum(ackpkt);
+    /* ACK the packet itself.  A selective acknowledgement is cumulative,
+       and is sent once the packet has been taken in */
+    if (!s->cfg->sack)
+      sendack(s, packet.seqnum);
     
-    /* send ACK */
-    tolayer3(B, ackpkt);
-    
-    /* deliver data to layer 5 if it's the expected packet */
-    if (packet.seqnum == B_nextseqnum) {
-      tolayer5(B, packet.payload);
-      B_nextseqnum = (B_nextseqnum + 1) % SEQSPACE;
+    /* buffer the packet if it is within the receive window and new.
+       Packets below the window were delivered already, their ACK was lost */
+    if ((packet.seqnum - b->expectedseqnum + b->seqspace) % b->seqspace < b->windowsize
+        && !b->received[packet.seqnum]) {
+      b->buffer[packet.seqnum] = packet;
+      b->received[packet.seqnum] = true;
+      if (packet.seqnum != b->expectedseqnum && TRACING(2))
+        printf("----B: packet %d is out of order, buffered\n", packet.seqnum);
+    }
+
+    /* deliver the run of packets that starts at the window */
+    while (b->received[b->expectedseqnum]) {
+      tolayer5(s, B, b->buffer[b->expectedseqnum].payload);
+      b->received[b->expectedseqnum] = false;
+      b->expectedseqnum = (b->expectedseqnum + 1) % b->seqspace;
     }
+    if (s->cfg->sack)
+      sendack(s, (b->expectedseqnum + b->seqspace - 1) % b->seqspace);
   }
   else {
-    if (TRACE > 0)
+    if (TRACING(1))
       printf("----B: packet is corrupted, send NAK!\n");
     
-    /* create and send NAK packet */
-    ackpkt.seqnum = NOTINUSE;
-    ackpkt.acknum = B_nextseqnum ? B_nextseqnum - 1 : SEQSPACE - 1;
-    ackpkt.checksum = 0;
-    for (i = 0; i < 20; i++)
-      ackpkt.payload[i] = 0;
-    ackpkt.checksum = ComputeChecksum(ackpkt);
-    
-    /* send NAK */
-    tolayer3(B, ackpkt);
+    /* send NAK, the ACK of the last packet delivered */
+    sendack(s, b->expectedseqnum ? b->expectedseqnum - 1 : b->seqspace - 1);
   }
 }
 
 /* initialization function */
-void B_init(void)
+void B_init(struct sim *s)
 {
-  B_nextseqnum = 0;
+  struct receiver *b;
+  int windowsize, seqspace;
+  int i;
+
+  getwindow(s, &windowsize, &seqspace);
+  b = malloc(sizeof(struct receiver) + seqspace * (sizeof(struct pkt) + sizeof(bool)));
+  if (b == NULL) {
+    printf("memory allocation for receiver failed.");
+    exit(EXIT_FAILURE);
+  }
+  s->B_state = b;
+  b->windowsize = windowsize;
+  b->seqspace = seqspace;
+  b->buffer = (struct pkt *)(b + 1);
+  b->received = (bool *)(b->buffer + seqspace);
+  b->expectedseqnum = 0;
+
+  for (i = 0; i < b->seqspace; i++)
+    b->received[i] = false;
 }
 
 /* functions for bidirectional communication */
-void B_output(struct msg message)
+void B_output(struct sim *s, struct msg message)
 {
 }
 
-void B_timerinterrupt(void)
+void B_timerinterrupt(struct sim *s)
 {
 }
\ No newline at end of file
@@ -0,0 +1,26 @@
+# Shared by the tests, which are run from anywhere as "sh tests/<name>.sh"
+# and print PASS or FAIL.  Protocols are built from the sources at the
+# top of the tree into a scratch directory.
+
+top=$(cd "$(dirname "$0")/.." && pwd)
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+fail()
+{
+  echo "FAIL: $*"
+  exit 1
+}
+
+# build the protocol $1, gbn or sr, as $tmp/$1
+build()
+{
+  srcs=
+  for f in "$top"/*.c; do
+    case ${f##*/} in
+      gbn.c|sr.c|tracedump.c) ;;
+      *) srcs="$srcs $f" ;;
+    esac
+  done
+  ${CC:-cc} -o "$tmp/$1" $srcs "$top/$1.c" -lpthread -lm || fail "cannot build $1"
+}
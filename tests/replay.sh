@@ -0,0 +1,24 @@
+#!/bin/sh
+# Trace replay takes finite delays that are not negative, and rejects
+# the rest with the line's number.  strtod() reads "nan" and "inf", and
+# either would put a time the clock never reaches into the event queue
+
+. "$(dirname "$0")/common.sh"
+build gbn
+
+run()
+{
+  printf '%s\n' "$1" >"$tmp/trace"
+  timeout 10 "$tmp/gbn" -n 10 -l 0 -c 0 -m 10 -v 0 -P "$tmp/trace" </dev/null >"$tmp/out"
+}
+
+run "A 12.5" || fail "a delay of 12.5 was rejected"
+grep -q "delivered to application:  10 " "$tmp/out" || fail "a delay of 12.5 lost messages"
+for delay in nan NAN inf -inf infinity 1e999 -1 12.5x; do
+  run "A $delay"
+  status=$?
+  [ $status -ne 124 ] || fail "a delay of $delay hung the simulation"
+  [ $status -ne 0 ] || fail "a delay of $delay was accepted"
+  grep -q "trace:1: expected A or B and a delay" "$tmp/out" || fail "a delay of $delay gave no message"
+done
+echo PASS
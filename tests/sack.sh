@@ -0,0 +1,18 @@
+#!/bin/sh
+# GBN with selective acknowledgements: B holds the packets that arrive
+# after a lost one, and once an ACK tells A so, A does not resend them.
+# Ten messages never wrap the sequence numbers round
+
+. "$(dirname "$0")/common.sh"
+build gbn
+
+"$tmp/gbn" -n 10 -l 0.2 -c 0 -d 0 -m 2 -v 2 -k 1 -s 2 </dev/null >"$tmp/out" \
+  || fail "gbn exited with status $?"
+awk '/^----B: packet [0-9]+ is out of order, hold it/ { nheld++ }
+     /^----A: packet [0-9]+ is held by B/ { known[$3] = 1; nknown++ }
+     /^---A: resending packet / && ($4 in known) { print "A resent packet " $4 " that B holds"; bad = 1 }
+     END { if (nheld == 0) print "B held no packet"
+           else if (nknown == 0) print "A never learnt that B held a packet"
+           exit (nknown == 0 || bad) }' "$tmp/out" >"$tmp/why" \
+  || fail "$(cat "$tmp/why")"
+echo PASS
@@ -0,0 +1,47 @@
+/* Binary event trace written by the emulator with "-t file" and rendered
+   back to text by tracedump.  The file is a struct traceheader followed by
+   fixed size struct tracerec records in the byte order of the machine that
+   wrote it. */
+#include <stdint.h>
+
+#define TRACE_MAGIC   "EMUTRACE"
+#define TRACE_VERSION 1
+
+struct traceheader {
+  char magic[8];          /* TRACE_MAGIC, not null terminated */
+  uint32_t version;       /* TRACE_VERSION */
+  uint32_t recsize;       /* sizeof(struct tracerec) */
+};
+
+struct tracerec {
+  float time;             /* simulation time of the record */
+  uint8_t kind;           /* one of the TR_ codes below */
+  uint8_t entity;         /* A or B */
+  uint16_t flags;         /* kind specific, see TRF_ codes */
+  int32_t seqnum;         /* packet sequence number, if any */
+  int32_t acknum;         /* packet acknowledgement number, if any */
+};
+
+/* record kinds.  The first three match the emulator's event types and
+   are written as each event is taken off the event list */
+#define TR_TIMER_INTERRUPT 0
+#define TR_FROM_LAYER5     1
+#define TR_FROM_LAYER3     2
+#define TR_TOLAYER3        3  /* entity handed a packet to layer 3 */
+#define TR_LOST            4  /* ... and the channel lost it */
+#define TR_CORRUPT         5  /* ... and the channel corrupted it */
+#define TR_TOLAYER5        6  /* data delivered to the application */
+#define TR_STARTTIMER      7
+#define TR_STOPTIMER       8
+#define TR_REORDER         9  /* the channel held the packet back */
+#define TR_DUPLICATE      10  /* the channel delivers the packet twice */
+
+/* flags of a TR_CORRUPT record: which part of the packet was damaged */
+#define TRF_PAYLOAD        1
+#define TRF_SEQNUM         2
+#define TRF_ACKNUM         4
+
+/* flags of a TR_LOST record */
+#define TRF_QUEUE          8  /* dropped by the full queue of the link */
+#define TRF_AQM           16  /* dropped by active queue management, when
+                                 it reaches the head of the queue */
@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "trace.h"
+
+/* ******************************************************************
+   Prints a binary trace written by the emulator's "-t" option in the
+   style of the emulator's own text tracing.
+
+   usage: tracedump tracefile
+**********************************************************************/
+
+#define READBUF 4096      /* records read from the file at a time */
+
+static void printrec(struct tracerec *r)
+{
+  char who = (r->entity == 0) ? 'A' : 'B';
+
+  switch (r->kind) {
+  case TR_TIMER_INTERRUPT:
+  case TR_FROM_LAYER5:
+  case TR_FROM_LAYER3:
+    printf("\nEVENT time: %f,", r->time);
+    printf("  type: %d", r->kind);
+    if (r->kind == TR_TIMER_INTERRUPT)
+      printf(", timerinterrupt  ");
+    else if (r->kind == TR_FROM_LAYER5)
+      printf(", fromlayer5 ");
+    else
+      printf(", fromlayer3 ");
+    printf(" entity: %d", r->entity);
+    if (r->kind == TR_FROM_LAYER3)
+      printf(" seq: %d, ack %d", r->seqnum, r->acknum);
+    printf("\n");
+    break;
+  case TR_TOLAYER3:
+    printf("          TOLAYER3: %c sends seq: %d, ack %d\n", who, r->seqnum, r->acknum);
+    break;
+  case TR_LOST:
+    printf("          TOLAYER3: %c sends seq: %d, ack %d\n", who, r->seqnum, r->acknum);
+    if (r->flags & TRF_QUEUE)
+      printf("          TOLAYER3: packet dropped by the full link queue\n");
+    else if (r->flags & TRF_AQM)
+      printf("          TOLAYER3: packet dropped by queue management\n");
+    else
+      printf("          TOLAYER3: packet being lost\n");
+    break;
+  case TR_CORRUPT:
+    printf("          TOLAYER3: packet being corrupted (%s)\n",
+           (r->flags & TRF_PAYLOAD) ? "payload" : (r->flags & TRF_SEQNUM) ? "seqnum" : "acknum");
+    break;
+  case TR_REORDER:
+    printf("          TOLAYER3: packet being held back\n");
+    break;
+  case TR_DUPLICATE:
+    printf("          TOLAYER3: packet being duplicated\n");
+    break;
+  case TR_TOLAYER5:
+    printf("          TOLAYER5: data received by application at %c\n", who);
+    break;
+  case TR_STARTTIMER:
+    printf("          START TIMER: starting timer at %f\n", r->time);
+    break;
+  case TR_STOPTIMER:
+    printf("          STOP TIMER: stopping timer at %f\n", r->time);
+    break;
+  default:
+    printf("unknown trace record kind %d at time %f\n", r->kind, r->time);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  struct traceheader hdr;
+  struct tracerec *recs;
+  FILE *fp;
+  size_t n, i;
+
+  if (argc != 2) {
+    printf("usage: %s tracefile\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  fp = fopen(argv[1], "rb");
+  if (fp == NULL) {
+    printf("unable to open %s\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || memcmp(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic)) != 0) {
+    printf("%s is not an emulator trace\n", argv[1]);
+    return EXIT_FAILURE;
+  }
+  if (hdr.version != TRACE_VERSION || hdr.recsize != sizeof(struct tracerec)) {
+    printf("%s has trace version %lu with %lu byte records, expected version %d with %lu\n",
+           argv[1], (unsigned long)hdr.version, (unsigned long)hdr.recsize,
+           TRACE_VERSION, (unsigned long)sizeof(struct tracerec));
+    return EXIT_FAILURE;
+  }
+
+  recs = malloc(READBUF * sizeof(struct tracerec));
+  if (recs == NULL) {
+    printf("memory allocation for trace records failed.");
+    return EXIT_FAILURE;
+  }
+  while ((n = fread(recs, sizeof(struct tracerec), READBUF, fp)) > 0)
+    for (i = 0; i < n; i++)
+      printrec(&recs[i]);
+
+  free(recs);
+  fclose(fp);
+  return EXIT_SUCCESS;
+}